@@ -16,6 +16,19 @@
 #define	ADC_CH1		(1)		// AN2, 右センサ
 #define	ADC_LEFT	ADC_CH0	// AN1, 左センサ
 #define	ADC_RIGHT	ADC_CH1	// AN2, 左センサ
+#define	ADC_CH6		(6)		// AD6 (PIO1_10), 電源電圧
+#define	ADC_VBAT	ADC_CH6	// AD6 (PIO1_10), 電源電圧
+
+/*----------------------------------------------------------------------
+ * 電源電圧の測定
+ * - 電池電圧を抵抗で分圧し、AD6 (PIO1_10) に入力する（要配線）
+ * - 電源電圧[mV] = A/D変換値 × ADC_VREF ÷ 1024 × ADC_VBAT_DIVIDER
+ * - ADC_VBAT_ON: 1 = 分圧回路を配線し、電源電圧（AD6）もA/D変換する
+ *   0 の場合は PIO1_10 を使用せず、バースト変換は AD0、AD1 のみとなる
+ *----------------------------------------------------------------------*/
+#define	ADC_VBAT_ON			0
+#define	ADC_VREF			3300	// A/D変換の基準電圧[mV]
+#define	ADC_VBAT_DIVIDER	2		// 分圧比（例: 10kΩ + 10kΩ）
 
 /*----------------------------------------------------------------------
  * 関数のプロトタイプ宣言
@@ -23,6 +36,7 @@
 extern void adcInit(void);
 extern unsigned short adcRead(unsigned char ch);
 extern void adcRead2(unsigned short *L, unsigned short *R);
+extern unsigned short adcReadVoltage(void);
 
 #ifdef	EXAMPLE
 /*===============================================================================
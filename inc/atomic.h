@@ -0,0 +1,190 @@
+/*===============================================================================
+ * Name        : atomic.h
+ * Author      : $(author)
+ * Version     :
+ * CPU type    : ARM Cortex-M3 LPC1343
+ * Copyright   : $(copyright)
+ * Description : Atomic operations, critical sections and SPSC ring buffers
+ *===============================================================================*/
+#ifndef _ATOMIC_H_
+#define _ATOMIC_H_
+
+/*----------------------------------------------------------------------
+ * 割込みハンドラとメイン処理で共有する変数の操作
+ * - LDREX/STREX による読み出し～更新～書き込みは、途中で割込みが入ると
+ *   STREX が失敗してやり直すため、割込みを禁止せずに不可分となる
+ * - 割込みハンドラ内での繰り返しを短くするため、関数はすべてインライン展開する
+ * - LPC13xx.h（CMSIS）の後でインクルードすること
+ *
+ * ARMv7-M Architecture Reference Manual
+ *	A3.4 Synchronization and semaphores
+ *	A3.7.3 Memory barriers
+ *----------------------------------------------------------------------*/
+typedef volatile unsigned long Atomic_t;		// 不可分に操作する変数
+typedef volatile unsigned long AtomicFlag_t;	// 不可分に操作するフラグ（0 / 1）
+
+// コンパイラによる命令の並べ替えと、メモリアクセスの順序を保証する
+// ホスト上のテストでは tools/host/LPC13xx.h で置き換える
+#ifndef	atomicBarrier
+#define	atomicBarrier()		__asm volatile ("dmb" ::: "memory")
+#endif
+
+/*----------------------------------------------------------------------
+ * 読み出し、書き込み（ワード単位のアクセスは不可分）
+ *----------------------------------------------------------------------*/
+static inline unsigned long atomicLoad(Atomic_t *p) {
+	return *p;
+}
+
+static inline void atomicStore(Atomic_t *p, unsigned long v) {
+	*p = v;
+}
+
+/*----------------------------------------------------------------------
+ * 加算（戻り値は加算後の値）
+ *----------------------------------------------------------------------*/
+static inline unsigned long atomicAdd(Atomic_t *p, long v) {
+	unsigned long x;
+
+	do {
+		x = __LDREXW((uint32_t *)p) + v;
+	} while (__STREXW(x, (uint32_t *)p));
+
+	return x;
+}
+
+#define	atomicInc(p)	atomicAdd((p),  1)
+#define	atomicDec(p)	atomicAdd((p), -1)
+
+/*----------------------------------------------------------------------
+ * 0 より大きければ減算する（戻り値は減算前の値、0 なら減算しない）
+ * - 起動要求などの計数を、割込みハンドラと競合せずに1つ消化する
+ *----------------------------------------------------------------------*/
+static inline unsigned long atomicDecIfPositive(Atomic_t *p) {
+	unsigned long x;
+
+	do {
+		x = __LDREXW((uint32_t *)p);
+		if (x == 0) {
+			__CLREX();
+			break;
+		}
+	} while (__STREXW(x - 1, (uint32_t *)p));
+
+	return x;
+}
+
+/*----------------------------------------------------------------------
+ * 交換（戻り値は交換前の値）
+ *----------------------------------------------------------------------*/
+static inline unsigned long atomicExchange(Atomic_t *p, unsigned long v) {
+	unsigned long x;
+
+	do {
+		x = __LDREXW((uint32_t *)p);
+	} while (__STREXW(v, (uint32_t *)p));
+
+	return x;
+}
+
+/*----------------------------------------------------------------------
+ * 比較して交換（値が expected の場合だけ desired に更新し、1 を返す）
+ *----------------------------------------------------------------------*/
+static inline int atomicCompareExchange(Atomic_t *p, unsigned long expected, unsigned long desired) {
+	do {
+		if (__LDREXW((uint32_t *)p) != expected) {
+			__CLREX();
+			return 0;
+		}
+	} while (__STREXW(desired, (uint32_t *)p));
+
+	return 1;
+}
+
+/*----------------------------------------------------------------------
+ * フラグの操作
+ *----------------------------------------------------------------------*/
+#define	atomicFlagSet(f)			atomicStore((f), 1)
+#define	atomicFlagClear(f)			atomicStore((f), 0)
+#define	atomicFlagTest(f)			(atomicLoad(f) != 0)
+#define	atomicFlagTestAndSet(f)		(atomicExchange((f), 1) != 0)	// セット前の状態
+#define	atomicFlagTestAndClear(f)	(atomicExchange((f), 0) != 0)	// クリア前の状態
+
+/*----------------------------------------------------------------------
+ * クリティカルセクション
+ * - critEnter(): すべての割込みを禁止する（入れ子にできる）
+ * - critEnterIRQ(): 指定した割込みだけを禁止する
+ *	 その割込みハンドラとだけ共有する変数の更新に使い、他の割込みの遅れをなくす
+ * 使用例：
+ *	CritState_t s = critEnterIRQ(TIMER_32_0_IRQn);
+ *	...	// TIMER32_0_IRQHandler() と共有する変数の更新
+ *	critExitIRQ(TIMER_32_0_IRQn, s);
+ *----------------------------------------------------------------------*/
+typedef unsigned long CritState_t;
+
+static inline CritState_t critEnter(void) {
+	CritState_t s = __get_PRIMASK();
+
+	__disable_irq();
+	return s;
+}
+
+static inline void critExit(CritState_t s) {
+	__set_PRIMASK(s);
+}
+
+static inline CritState_t critEnterIRQ(IRQn_Type irq) {
+	// 6.6.1 Interrupt Set-Enable Register 0 register (ISER0)
+	CritState_t s = NVIC->ISER[(unsigned long)irq >> 5] & (1UL << ((unsigned long)irq & 0x1F));
+
+	NVIC_DisableIRQ(irq);
+
+	// 禁止が反映されてから、共有する変数にアクセスする
+	__DSB();
+	__ISB();
+	return s;
+}
+
+static inline void critExitIRQ(IRQn_Type irq, CritState_t s) {
+	if (s) {
+		NVIC_EnableIRQ(irq);
+	}
+}
+
+/*----------------------------------------------------------------------
+ * 1対1（Single-Producer / Single-Consumer）のリングバッファ
+ * - 書き込み側だけが head を、読み出し側だけが tail を更新するため、
+ *   割込みハンドラとメイン処理の間で割込みを禁止せずに受け渡しできる
+ * - 要素数は2のべき乗とし、head - tail で格納数を求める
+ * 使用例：
+ *	SPSC_DEFINE(rx, unsigned short, 32);
+ *	spscPut(&rx, &data);	// 割込みハンドラ
+ *	spscGet(&rx, &data);	// メイン処理
+ *----------------------------------------------------------------------*/
+typedef struct {
+	unsigned char *buf;			// 要素の格納領域
+	unsigned short size;		// 要素数（2のべき乗）
+	unsigned short elem;		// 要素の大きさ[byte]
+	volatile unsigned long head;	// 次に書き込む位置（書き込み側のみ更新）
+	volatile unsigned long tail;	// 次に読み出す位置（読み出し側のみ更新）
+} Spsc_t;
+
+#define	SPSC_DEFINE(name, type, n) \
+	static type name##Buf[(n)]; \
+	static Spsc_t name = {(unsigned char *)name##Buf, (n), sizeof(type), 0, 0}
+
+extern int spscPut(Spsc_t *q, const void *data);
+extern int spscGet(Spsc_t *q, void *data);
+extern int spscCount(Spsc_t *q);
+
+#ifdef	EXAMPLE
+/*===============================================================================
+ * 不可分操作とリングバッファの動作確認
+ * - exampleType
+ *	1: 割込みハンドラとメイン処理による加算の競合
+ *	2: リングバッファの受け渡し
+ *===============================================================================*/
+extern void atomicExample(int exampleType);
+#endif // EXAMPLE
+
+#endif // _ATOMIC_H_
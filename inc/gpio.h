@@ -14,13 +14,32 @@
 #include "LPC13xx.h"
 #endif
 
+/*----------------------------------------------------------------------
+ * ピン記述子
+ * - 同じポートのピンの組を「ポート, ビットマスク」の組で表し、マスクはコンパイル時に確定する
+ * - 9.4.1 GPIO data register: MASKED_ACCESS[mask] への1回の書き込みで mask のビットだけを
+ *   更新するため、複数のピンでも読み出し～書き戻し（read-modify-write）なしに出力できる
+ * - 書き込む値はマスクの位置に揃えておく（実行時のシフトは不要）
+ * 使用例：
+ *	#define	PINS_DIR	GPIO_PINS_OF(LPC_GPIO2, GPIO_MASK(0) | GPIO_MASK(1))
+ *	gpioPinWrite(PINS_DIR, GPIO_MASK(0));	// PIO2_0 = 'H', PIO2_1 = 'L'
+ *----------------------------------------------------------------------*/
+#define	GPIO_MASK(b)			(1UL << (b))
+#define	GPIO_PINS_OF(p, mask)	p, (mask)
+#define	GPIO_PIN(p, b)			GPIO_PINS_OF(p, GPIO_MASK(b))
+
+#define	gpioPinWrite(pins, v)	gpioMaskedWrite(pins, v)
+#define	gpioPinRead(pins)		gpioMaskedRead(pins)
+#define	gpioMaskedWrite(p, mask, v)	((p)->MASKED_ACCESS[(mask)] = (v))
+#define	gpioMaskedRead(p, mask)		((p)->MASKED_ACCESS[(mask)])
+
 /*----------------------------------------------------------------------
  * GPIO functions
  *----------------------------------------------------------------------*/
 #if		1
 #define	gpioSetDir(p, b, d)	{if((d)){(p)->DIR |=(1<<(b));}else{(p)->DIR &= ~(1<<(b));}}
-#define	gpioSetBit(p, b, v)	{(p)->MASKED_ACCESS[(1<<(b))] = ((v)<<(b));}
-#define	gpioGetBit(p, b)	((p)->MASKED_ACCESS[(1<<(b))])
+#define	gpioSetBit(p, b, v)	{gpioPinWrite(GPIO_PIN(p, b), (v)<<(b));}
+#define	gpioGetBit(p, b)	gpioPinRead(GPIO_PIN(p, b))
 #else
 extern void gpioSetDir(__IO LPC_GPIO_TypeDef* port, uint32_t bit, uint32_t dir);
 extern void gpioSetBit(__IO LPC_GPIO_TypeDef* port, uint32_t bit, uint32_t val);
@@ -38,8 +57,19 @@ extern unsigned char gpioGetBit(__IO LPC_GPIO_TypeDef* port, uint32_t bit);
 #define	INT_MODE_CHANGE		2	// 両エッジで割り込みを検出
 #define	INT_MODE_LOW		3	// LOWレベルで割り込みを検出
 #define	INT_MODE_HIGH		4	// HIGHレベルで割り込みを検出
+#define	INT_MODE_ONESHOT	0x80	// 1回検出したらそのピンの割込みを止める（他のモードと論理和で指定）
+
+/*----------------------------------------------------------------------
+ * ピンごとの割込みの監視
+ * - 1つのポートで最大 GPIO_PINS 本のピンを監視でき、ピンごとに関数を登録する
+ * - 割込みハンドラは MIS から発生したピンを番号の大きい順に取り出して関数を呼び出す
+ * - INT_MODE_ONESHOT のピンは、gpioEnableInterrupt() で再び監視を始める
+ *----------------------------------------------------------------------*/
+#define	GPIO_PINS			12	// 1ポート当たりのピン数（PIOn_0～PIOn_11）
 
 extern void gpioSetInterrupt(uint32_t portNo, uint32_t pin, uint8_t mode, void (*f)(void));
+extern void gpioEnableInterrupt(uint32_t portNo, uint32_t pin);
+extern void gpioDisableInterrupt(uint32_t portNo, uint32_t pin);
 
 /*----------------------------------------------------------------------
  * 割込み処理用テーブル
@@ -47,10 +77,47 @@ extern void gpioSetInterrupt(uint32_t portNo, uint32_t pin, uint8_t mode, void (
 typedef struct {
 	__IO LPC_GPIO_TypeDef* port;	// GPIOポートアドレス
 	IRQn_Type irqNo;				// 割込みNo
-	uint32_t pin;					// 割込みを監視するピン
-	void (*function)(void);			// 割込み発生時に実行する関数
+	uint32_t pins;					// 割込みを監視するピン（ビットマップ）
+	uint32_t oneshot;				// INT_MODE_ONESHOT のピン（ビットマップ）
+	void (*function[GPIO_PINS])(void);	// 割込み発生時に実行する関数
 } GPIO_IRQ_t;
 
+/*----------------------------------------------------------------------
+ * 割込みの処理統計
+ * - 遅延は割込みハンドラの開始から、各ピンの関数を呼び出すまでのサイクル数
+ *----------------------------------------------------------------------*/
+typedef struct {
+	unsigned long count;		// 関数を呼び出した回数
+	unsigned long maxLatency;	// 遅延の最大値[cycles]
+} GPIO_IRQStat_t;
+
+extern void gpioInterruptStat(uint32_t portNo, GPIO_IRQStat_t *stat);
+
+/*----------------------------------------------------------------------
+ * エッジ時刻の記録（キャプチャモード）
+ * - 1本のピンのエッジ時刻と、エッジから関数を呼び出すまでの遅延の分布を記録する
+ * - PIO1_0 はキャプチャ入力（CT32B1_CAP0）でエッジ時刻を取り込む（分解能 1[μsec]）
+ * - 他のピンは割込みハンドラの開始時刻をエッジ時刻とする（GPIO_IRQ_STAT = 1 の場合）
+ * - 割込みハンドラを登録済みのピン（SW1 など）は指定できない（戻り値 -1）
+ * 使用例：
+ *	gpioCapture(1, 0, INT_MODE_FALLING, f);		// PIO1_0（キャプチャ入力）
+ *	...
+ *	gpioCaptureStat(&stat);
+ *----------------------------------------------------------------------*/
+#define	GPIO_CAPTURE_BINS	16	// 遅延の度数分布の階級数
+
+typedef struct {
+	unsigned long edges;		// 記録したエッジの数
+	unsigned long lastEdge;		// 最後のエッジの時刻[cycles]（timerCycles()）
+	unsigned long maxLatency;	// 遅延の最大値[cycles]
+	unsigned long hist[GPIO_CAPTURE_BINS];	// [0]: 0, [i]: 2^(i-1) ～ 2^i - 1[cycles]（最後の階級はそれ以上）
+	unsigned char hardware;		// 1: キャプチャ入力で記録している
+} GPIO_CaptureStat_t;
+
+extern int gpioCapture(uint32_t portNo, uint32_t pin, uint8_t mode, void (*f)(void));
+extern void gpioCaptureStop(void);
+extern void gpioCaptureStat(GPIO_CaptureStat_t *stat);
+
 /*----------------------------------------------------------------------
  * GPIOの初期化
  *----------------------------------------------------------------------*/
@@ -66,6 +133,8 @@ extern void gpioInit(void);
 #define	GPIO_BIT_LED1	(3)
 #define	GPIO_BIT_LED2	(7)
 
+#define	GPIO_PINS_LED	GPIO_PINS_OF(LPC_GPIO0, GPIO_MASK(GPIO_BIT_LED1) | GPIO_MASK(GPIO_BIT_LED2))
+
 /*----------------------------------------------------------------------
  * LEDの点灯／消灯
  *----------------------------------------------------------------------*/
@@ -81,6 +150,39 @@ extern void ledToggle(unsigned char led);
 extern void ledFlush(unsigned long msec);
 extern void ledBlink(unsigned long msec);
 
+/*----------------------------------------------------------------------
+ * LEDの点灯パターン（タイマーの割込みでバックグラウンドに表示する）
+ * - 点灯データと表示時間[msec]の組を順に表示し、repeat 回繰り返す（0: 停止するまで）
+ * - 優先度（0 ～ LED_PRIO_LEVELS - 1）の高いパターンを表示し、終われば下位に戻る
+ * - パターンがなければ ledShow() の点灯データを表示する
+ * 使用例：
+ *	LED_PATTERN(lost, 0, {LED_ON, 50}, {LED_OFF, 50});
+ *	ledPlay(&lost, LED_PRIO_ALERT);
+ *----------------------------------------------------------------------*/
+#define	LED_PRIO_LEVELS	4		// 優先度の段階数
+#define	LED_PRIO_STATUS	1		// 動作状態（較正中、停止中など）
+#define	LED_PRIO_SHOW	2		// 数値の読み出し（showValue()）
+#define	LED_PRIO_ALERT	3		// 異常の通知
+
+typedef struct {
+	unsigned char led;			// 点灯データ（LED1, LED2, ...）
+	unsigned short msec;		// 表示時間[msec]
+} LedStep_t;
+
+typedef struct {
+	const LedStep_t *step;		// 点灯データと表示時間の表
+	unsigned char steps;		// 表の要素数
+	unsigned char repeat;		// 繰り返し回数（0: 停止するまで）
+} LedPattern_t;
+
+#define	LED_PATTERN(name, repeat, ...) \
+	static const LedStep_t name##Steps[] = {__VA_ARGS__}; \
+	static const LedPattern_t name = {name##Steps, sizeof(name##Steps) / sizeof(LedStep_t), (repeat)}
+
+extern int ledPlay(const LedPattern_t *p, int prio);
+extern void ledCancel(int prio);
+extern void ledShow(unsigned char led);
+
 /*----------------------------------------------------------------------
  * プッシュスイッチの状態
  *----------------------------------------------------------------------*/
@@ -97,15 +199,40 @@ extern int swClick(void);		// SWをスキャンしON→OFFの立上がりを検
 extern int swStandby(void);	// SWが押されてから離されるまで待機する
 extern void swWatch(void (*f)(void)); // 割込みの監視と処理関数の登録
 
+/*----------------------------------------------------------------------
+ * スイッチ操作（ジェスチャー）のイベント
+ *----------------------------------------------------------------------*/
+#define	SW_DOUBLE_TIME	300		// ダブルクリックとみなす間隔（離してから次の押下まで）[msec]
+#define	SW_LONG_TIME	1000	// 長押しの判定周期[msec]
+
+#define	SW_EVT_CLICK	1		// クリック
+#define	SW_EVT_DOUBLE	2		// ダブルクリック
+#define	SW_EVT_LONG		3		// 長押し（SW_LONG_TIME × n 経過）
+#define	SW_EVT_HOLD		4		// 長押しの後で離した
+
+typedef struct {
+	unsigned char type;			// SW_EVT_CLICK ～ SW_EVT_HOLD
+	unsigned char n;			// 長押しの経過回数（SW_EVT_LONG, SW_EVT_HOLD）
+	unsigned long time;			// 発生時刻[msec]（timerRead()）
+} SwEvent_t;
+
+extern void swSubscribe(void (*f)(const SwEvent_t *e));
+extern int swGetEvent(SwEvent_t *e);
+
 /*----------------------------------------------------------------------
  * SWが押されるまで待機し、指定時間長押しされた場合にONを返す
  *----------------------------------------------------------------------*/
 extern int swClickHold(unsigned long msec);
 
 /*----------------------------------------------------------------------
- * 指定の整数値をLEDに出力する
+ * 指定の整数値をLEDとブザーで読み出す（待機しない）
  *----------------------------------------------------------------------*/
-extern void showValue(long val);
+extern void showValue(unsigned long val);	// 値を保存して先頭の2ビットを表示する
+extern void showNext(void);				// 次の2ビットを表示する
+extern void showRewind(void);			// 先頭の2ビットに戻る
+extern void showStop(void);				// 表示を終える
+extern int showActive(void);			// 1: 表示中
+extern void showEvent(const SwEvent_t *e);	// スイッチ操作で読み出しを進める
 
 #ifdef	EXAMPLE
 /*===============================================================================
@@ -0,0 +1,59 @@
+/*===============================================================================
+ * Name        : os.h
+ * Author      : $(author)
+ * Version     :
+ * CPU type    : ARM Cortex-M3 LPC1343
+ * Copyright   : $(copyright)
+ * Description : Fixed-priority preemptive kernel definitions
+ *===============================================================================*/
+#ifndef _OS_H_
+#define _OS_H_
+
+/*----------------------------------------------------------------------
+ * カーネルの設定
+ * - 優先度の値が小さいほど優先され、実行可能になれば低い優先度のスレッドを横取りする
+ * - 同じ優先度のスレッドは、待機するか osYield() するまで切り替わらない
+ *----------------------------------------------------------------------*/
+#define	OS_THREAD_MAX	6		// 登録できるスレッドの数（アイドルスレッドを除く）
+#define	OS_TICK_HZ		1000	// SysTick の周波数[Hz]
+#define	OS_PRIO_IDLE	0xFF	// アイドルスレッドの優先度（最低）
+
+/*----------------------------------------------------------------------
+ * スレッドのスタック領域の定義（8バイト境界に配置する）
+ * - 例外時に積まれる8ワードと、退避する r4～r11 の8ワードを含めること
+ * 使用例：
+ *	OS_STACK(stack, 128);
+ *	osThreadCreate(thread, stack, 128, 1);
+ *----------------------------------------------------------------------*/
+#define	OS_STACK(name, words)	static unsigned long name[(words)] __attribute__((aligned(8)))
+
+/*----------------------------------------------------------------------
+ * 関数のプロトタイプ宣言
+ *----------------------------------------------------------------------*/
+extern int osThreadCreate(void (*f)(void), unsigned long *stack, unsigned long words, int priority);
+extern void osStart(void);
+extern void osYield(void);
+extern void osDelay(unsigned long msec);
+extern void osWait(void);
+extern void osSignal(int id);
+extern int osSelf(void);
+extern unsigned long osTicks(void);
+
+/*----------------------------------------------------------------------
+ * SysTick のサービス
+ * - msec[msec]周期で f を SysTick 割込みハンドラから呼び出す（f = 0 で解除）
+ * - カーネルを起動していなくても使用できる（ウォッチドッグの更新など）
+ *----------------------------------------------------------------------*/
+extern void osTickHook(void (*f)(void), unsigned long msec);
+
+#ifdef	EXAMPLE
+/*===============================================================================
+ * プリエンプティブカーネルの動作確認
+ * - exampleType
+ *	1: コンテキスト切替時間の計測
+ *	2: 制御スレッドの最悪起動遅延の計測
+ *===============================================================================*/
+extern void osExample(int exampleType);
+#endif // EXAMPLE
+
+#endif // _OS_H_
@@ -93,6 +93,15 @@ extern void playScore(const MusicScore_t *score, int num, int tempo, int loop);
 extern void playStop(void);
 extern int playIsPlaying(void);
 
+/*----------------------------------------------------------------------
+ * 割込みハンドラの負荷の計測（1: playLoad() で実行時間の割合[1/1000]を返す）
+ *----------------------------------------------------------------------*/
+#define	PLAY_STAT		0
+
+#if	PLAY_STAT && PLAY_MODE != PLAY_PWM_WRC103
+extern unsigned long playLoad(void);
+#endif
+
 #if	PLAY_MODE == PLAY_PWM_WRC103
 extern void BuzzerSet(unsigned char pitch, unsigned char vol);
 extern void BuzzerStart(void);
@@ -471,6 +480,120 @@ extern unsigned char isBuzzer(void);
 #define  N81     14  // N8 + N1
 #define  N80     18  // N8 + N0
 
+/*----------------------------------------------------------------------
+ * 圧縮した楽譜データ（1要素 2バイト、MusicScore_t の半分）
+ * - pitch   : 音階の番号（PI_Do2 ～ PI_Do7、0 = 休符）
+ * - duration: 音符長（N16 ～ N80 およびその和、255 以下）
+ * - 繰り返し: pitch = PLAY_PK_REPEAT の要素は、直前の len 個の要素を
+ *             count 回だけ続けて再生する（len, count = 1 ～ 16）
+ *
+ * 楽譜データ（*.dat）は tools/dat2pk.py で変換する
+ *	PS(Ra5, N8), PS(0, N8), PS(Mi5, N4x + N0), PR(4, 1), ...
+ *----------------------------------------------------------------------*/
+typedef struct {
+	unsigned char pitch;		// 音階の番号
+	unsigned char duration;		// 音符の長さ
+} PackedScore_t;
+
+#define	PLAY_PK_REPEAT	0xFF	// 繰り返しの指定
+#define	PLAY_PITCHES	62		// 音階の番号の数（休符を含む）
+
+#define	PS(p, n)		{PI_##p, (n)}
+#define	PR(len, count)	{PLAY_PK_REPEAT, ((((count) - 1) << 4) | ((len) - 1))}
+
+/*----------------------------------------------------------------------
+ * 音階の番号（PackedScore_t.pitch）の定義
+ *----------------------------------------------------------------------*/
+#define PI_0      0
+#define PI_Do2    1
+#define PI_Do2s   2
+#define PI_Re2f   2
+#define PI_Re2    3
+#define PI_Re2s   4
+#define PI_Mi2f   4
+#define PI_Mi2    5
+#define PI_Fa2    6
+#define PI_Fa2s   7
+#define PI_So2f   7
+#define PI_So2    8
+#define PI_So2s   9
+#define PI_Ra2f   9
+#define PI_Ra2    10
+#define PI_Ra2s   11
+#define PI_Si2f   11
+#define PI_Si2    12
+#define PI_Do3    13
+#define PI_Do3s   14
+#define PI_Re3f   14
+#define PI_Re3    15
+#define PI_Re3s   16
+#define PI_Mi3f   16
+#define PI_Mi3    17
+#define PI_Fa3    18
+#define PI_Fa3s   19
+#define PI_So3f   19
+#define PI_So3    20
+#define PI_So3s   21
+#define PI_Ra3f   21
+#define PI_Ra3    22
+#define PI_Ra3s   23
+#define PI_Si3f   23
+#define PI_Si3    24
+#define PI_Do4    25
+#define PI_Do4s   26
+#define PI_Re4f   26
+#define PI_Re4    27
+#define PI_Re4s   28
+#define PI_Mi4f   28
+#define PI_Mi4    29
+#define PI_Fa4    30
+#define PI_Fa4s   31
+#define PI_So4f   31
+#define PI_So4    32
+#define PI_So4s   33
+#define PI_Ra4f   33
+#define PI_Ra4    34
+#define PI_Ra4s   35
+#define PI_Si4f   35
+#define PI_Si4    36
+#define PI_Do5    37
+#define PI_Do5s   38
+#define PI_Re5f   38
+#define PI_Re5    39
+#define PI_Re5s   40
+#define PI_Mi5f   40
+#define PI_Mi5    41
+#define PI_Fa5    42
+#define PI_Fa5s   43
+#define PI_So5f   43
+#define PI_So5    44
+#define PI_So5s   45
+#define PI_Ra5f   45
+#define PI_Ra5    46
+#define PI_Ra5s   47
+#define PI_Si5f   47
+#define PI_Si5    48
+#define PI_Do6    49
+#define PI_Do6s   50
+#define PI_Re6f   50
+#define PI_Re6    51
+#define PI_Re6s   52
+#define PI_Mi6f   52
+#define PI_Mi6    53
+#define PI_Fa6    54
+#define PI_Fa6s   55
+#define PI_So6f   55
+#define PI_So6    56
+#define PI_So6s   57
+#define PI_Ra6f   57
+#define PI_Ra6    58
+#define PI_Ra6s   59
+#define PI_Si6f   59
+#define PI_Si6    60
+#define PI_Do7    61
+
+extern void playPacked(const PackedScore_t *score, int num, int tempo, int loop);
+
 #ifdef	EXAMPLE
 /*===============================================================================
  * バックグラウンド演奏の動作確認
@@ -478,6 +601,7 @@ extern unsigned char isBuzzer(void);
  * - フォアグラウンド演奏としたい場合は、以下の様に playIsPlaying() でブロックする
  *	playScore(...);
  *	while (playIsPlaying());
+ * - 圧縮した楽譜データ（*_pk.dat）は tools/dat2pk.py で *.dat から生成する
  *===============================================================================*/
 extern void playExample(void);
 #endif // EXAMPLE
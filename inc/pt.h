@@ -0,0 +1,55 @@
+/*===============================================================================
+ * Name        : pt.h
+ * Author      : $(author)
+ * Version     :
+ * CPU type    : ARM Cortex-M3 LPC1343
+ * Copyright   : $(copyright)
+ * Description : Protothread-style resumable functions
+ *===============================================================================*/
+#ifndef _PT_H_
+#define _PT_H_
+
+/*----------------------------------------------------------------------
+ * 再開可能な関数（Protothread）
+ * - 待機する箇所で PT_WAITING を返して呼び出し元に戻り、次の呼び出しでその箇所から再開する
+ * - 待機をまたぐ変数は static またはポインタで渡す構造体に置くこと（ローカル変数は保持されない）
+ * - switch 文の case を行番号で埋め込むため、1行に複数の PT_ マクロを書かないこと
+ *   また、PT_BEGIN() ～ PT_END() の間に switch 文を書かないこと
+ * 使用例：
+ *	static int blink(Pt_t *pt) {
+ *		PT_BEGIN(pt);
+ *		ledOn(LED1);
+ *		PT_DELAY(pt, 100);
+ *		ledOn(LED_OFF);
+ *		PT_END(pt);
+ *	}
+ *	while (blink(&pt) == PT_WAITING) { ... }	// タスクなどから周期的に呼び出す
+ *----------------------------------------------------------------------*/
+#define	PT_WAITING		0	// 待機中（再度呼び出す）
+#define	PT_DONE			1	// 終了（次の呼び出しでは先頭から実行する）
+
+typedef struct {
+	unsigned short lc;			// 再開する位置（行番号、0: 先頭）
+	unsigned long long until;	// PT_DELAY() の待機終了時刻[μsec]
+} Pt_t;
+
+#define	PT_INIT(pt)		((pt)->lc = 0)
+
+#define	PT_BEGIN(pt)	switch ((pt)->lc) { case 0:
+
+#define	PT_END(pt)		} PT_INIT(pt); return PT_DONE
+
+// 条件が成立するまで待機する
+#define	PT_WAIT_UNTIL(pt, cond) \
+	do { (pt)->lc = __LINE__; case __LINE__: if (!(cond)) return PT_WAITING; } while (0)
+
+// 呼び出し元に1回戻る
+#define	PT_YIELD(pt) \
+	do { (pt)->lc = __LINE__; return PT_WAITING; case __LINE__: ; } while (0)
+
+// 指定時間[msec]待機する（timer.h が必要）
+#define	PT_DELAY(pt, msec) \
+	do { (pt)->until = timerDeadline((unsigned long long)(msec) * 1000); \
+		 PT_WAIT_UNTIL(pt, timerExpired((pt)->until)); } while (0)
+
+#endif // _PT_H_
@@ -13,13 +13,84 @@
  * 関数のプロトタイプ宣言
  *----------------------------------------------------------------------*/
 extern void pwmInit(void);
-extern void pwmOut(int L, int R);
+extern void pwmOut(int L, int R);	// 調停を経由しない直接出力（通常は pwmRequest() を使う）
 
 /*----------------------------------------------------------------------
  * PWM出力の最大値
  *----------------------------------------------------------------------*/
 #define	PWM_MAX		(0xFFFF)	// 0～65536 (16bits)
 
+/*----------------------------------------------------------------------
+ * 駆動系の不感帯・非線形性の補正
+ * - PWM指示値（0～PWM_MAX）を PWM_COMP_STEP 間隔の折れ線で近似し、
+ *   車輪（左右）と回転方向（正転・逆転）ごとにデューティ値へ変換する
+ * - 補正テーブルは PWM_COMP_POINTS 点のデューティ値（0～PWM_MAX）で、
+ *   先頭は指示値 0 付近、末尾は指示値 PWM_MAX に対応する
+ *----------------------------------------------------------------------*/
+#define	PWM_COMP_SHIFT	13							// 折れ線の区間幅（2のべき乗）
+#define	PWM_COMP_STEP	(1 << PWM_COMP_SHIFT)		// 8192
+#define	PWM_COMP_POINTS	((PWM_MAX >> PWM_COMP_SHIFT) + 2)	// 9点（8区間）
+
+#define	PWM_WHEEL_L		(0)		// 左車輪
+#define	PWM_WHEEL_R		(1)		// 右車輪
+#define	PWM_DIR_FWD		(0)		// 正転（前進）
+#define	PWM_DIR_REV		(1)		// 逆転（後退）
+
+extern void pwmCompensate(int enable);
+extern void pwmSetCompTable(int wheel, int dir, const unsigned short *table);
+extern void pwmSetDeadZone(int wheel, int dir, unsigned short duty);
+extern void pwmBuildCompTable(int wheel, int dir, const unsigned short *speed);
+
+/*----------------------------------------------------------------------
+ * 電源電圧によるフィードフォワード補正
+ * - 電池の消耗によらず、ゲイン調整時と同じ実効駆動電圧になるようデューティを補正する
+ *----------------------------------------------------------------------*/
+extern int pwmSupplyComp(int enable);
+extern void pwmSetNominalVoltage(unsigned short mv);
+extern unsigned short pwmGetVoltage(void);
+
+/*----------------------------------------------------------------------
+ * モーター指示の調停
+ * - 指示元ごとに指示値を保持し、最も優先度の高い有効な指示を出力する
+ * - 指示は有効期間[msec]を過ぎると無効となり、有効な指示がなければ停止する
+ * - 非常停止 pwmEmergencyStop() は割込みハンドラからも呼び出せる
+ *----------------------------------------------------------------------*/
+#define	PWM_SRC_SAFETY	(0)		// 非常停止（最優先）
+#define	PWM_SRC_CALIB	(1)		// キャリブレーション
+#define	PWM_SRC_CONTROL	(2)		// ライントレース制御
+#define	PWM_SRC_MANUAL	(3)		// 手動操作、動作例
+#define	PWM_SRC_NUM		(4)		// 指示元の数（有効な指示なし）
+
+#define	PWM_NO_TIMEOUT	(0)		// 有効期間なし
+
+extern void pwmRequest(int src, int L, int R, unsigned long msec);
+extern void pwmRelease(int src);
+extern void pwmEmergencyStop(void);
+extern int pwmSource(void);
+
+/*----------------------------------------------------------------------
+ * 停止時の出力モードとブレーキ
+ * - 停止指示（0）に対する出力を実行時に選択する
+ * - pwmBrake() はカーブ手前などで、走行中でも指定のブレーキ動作を行う
+ * - ブレーキ中はPWM周期ごとにフック関数を呼び出し、停止の判定（非0）までの
+ *   PWM周期数を pwmBrakeTicks() で取得できる
+ *----------------------------------------------------------------------*/
+#define	PWM_BRAKE_COAST		(0)		// フリー（惰性で停止）
+#define	PWM_BRAKE_SHORT		(1)		// 短絡ブレーキ
+#define	PWM_BRAKE_REVERSE	(2)		// 逆転パルスの後、短絡ブレーキ
+
+typedef struct {
+	unsigned short duty;	// 逆転パルスのデューティ（0～PWM_MAX）
+	unsigned short reverse;	// 逆転パルスの時間[msec]
+	unsigned short hold;	// 短絡ブレーキの時間[msec]
+} PwmBrakeProfile_t;
+
+extern void pwmSetBrakeMode(int mode, const PwmBrakeProfile_t *profile);
+extern void pwmBrake(const PwmBrakeProfile_t *profile);
+extern int pwmIsBraking(void);
+extern void pwmSetBrakeHook(int (*f)(unsigned long ticks));
+extern unsigned long pwmBrakeTicks(void);
+
 #ifdef	EXAMPLE
 /*===============================================================================
  * モーターPWM制御の動作確認
@@ -28,6 +99,7 @@ extern void pwmOut(int L, int R);
  * - exampleType
  *	1: 直進性を確認し、駆動系のゲインを調整する
  *	2: 前進 --> 右旋回 --> 左旋回 --> 後退
+ *	3: 各車輪が回り始めるデューティ（不感帯）を計測し、補正テーブルを作成する
  *===============================================================================*/
 extern void pwmExample(int exampleType);
 #endif // EXAMPLE
@@ -0,0 +1,48 @@
+/*===============================================================================
+ * Name        : score.h
+ * Author      : $(author)
+ * Version     :
+ * CPU type    : ARM Cortex-M3 LPC1343
+ * Copyright   : $(copyright)
+ * Description : Flash-resident music score registry definitions
+ *===============================================================================*/
+#ifndef _SCORE_H_
+#define _SCORE_H_
+
+#include "play.h"
+
+/*----------------------------------------------------------------------
+ * 楽譜の登録
+ * - 圧縮した楽譜データ（*_pk.dat）を番号で引き、フラッシュから直接演奏する
+ * - 楽譜データと登録表は const でフラッシュに置き、RAM やスタックにコピーしない
+ * 使用例：
+ *	scorePlay(SCORE_TRUTH, 0, -1);	// 登録したテンポで繰り返し演奏
+ *----------------------------------------------------------------------*/
+#define	SCORE_DOREMI	0		// doremi_pk.dat
+#define	SCORE_LUPIN		1		// lupin_pk.dat
+#define	SCORE_TRUTH		2		// truth_pk.dat
+#define	SCORE_NUM		3		// 登録した楽譜の数
+
+/*----------------------------------------------------------------------
+ * フラッシュに配置するデータの指定
+ * - LPCXpresso のリンカスクリプトは .rodata* をフラッシュに配置する
+ *----------------------------------------------------------------------*/
+#define	SCORE_FLASH		__attribute__((section(".rodata.score")))
+
+/*----------------------------------------------------------------------
+ * 登録した楽譜
+ *----------------------------------------------------------------------*/
+typedef struct {
+	const char *name;				// 曲名
+	const PackedScore_t *score;		// 圧縮した楽譜データ
+	unsigned short num;				// 楽譜データの要素数
+	unsigned short tempo;			// 演奏する速さ（メトロノーム記号）
+} Score_t;
+
+/*----------------------------------------------------------------------
+ * 関数のプロトタイプ宣言
+ *----------------------------------------------------------------------*/
+extern const Score_t *scoreGet(int id);
+extern int scorePlay(int id, int tempo, int loop);
+
+#endif // _SCORE_H_
@@ -0,0 +1,43 @@
+/*===============================================================================
+ * Name        : task.h
+ * Author      : $(author)
+ * Version     :
+ * CPU type    : ARM Cortex-M3 LPC1343
+ * Copyright   : $(copyright)
+ * Description : Cooperative task scheduler definitions
+ *===============================================================================*/
+#ifndef _TASK_H_
+#define _TASK_H_
+
+/*----------------------------------------------------------------------
+ * タスクの設定
+ * - タスクは最後まで実行されてから次のタスクに切り替わる（協調型）
+ * - 優先度の値が小さいほど優先され、同じ優先度では先に登録したタスクが優先される
+ * - 最優先タスクの起動の遅れは、他タスクの最長実行時間以内に抑えられる
+ *----------------------------------------------------------------------*/
+#define	TASK_MAX		8		// 登録できるタスクの数
+#define	TASK_TICK		1		// 周期起動の時間分解能[msec]
+#define	TASK_EVENT		0		// 周期起動しない（taskSignal() でのみ起動する）
+
+/*----------------------------------------------------------------------
+ * タスクの実行統計
+ *----------------------------------------------------------------------*/
+typedef struct {
+	unsigned long runs;			// 実行回数
+	unsigned long long cycles;	// 実行サイクル数の累計
+	unsigned long maxCycles;	// 1回の実行サイクル数の最大値
+	unsigned long maxLate;		// 起動予定時刻からの遅れの最大値[μsec]
+	unsigned long overruns;		// 周期に間に合わず、起動を省略した回数
+} TaskStat_t;
+
+/*----------------------------------------------------------------------
+ * 関数のプロトタイプ宣言
+ *----------------------------------------------------------------------*/
+extern int taskCreate(void (*f)(void), unsigned long period, int priority);
+extern void taskSignal(int id);
+extern void taskSuspend(int id);
+extern void taskResume(int id);
+extern void taskRun(void);
+extern void taskStat(int id, TaskStat_t *stat);
+
+#endif // _TASK_H_
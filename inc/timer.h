@@ -10,21 +10,105 @@
 #define _TIMER_H_
 
 /*----------------------------------------------------------------------
- * 1[msec]を刻むプリスケールの設定
+ * 1[μsec]を刻むプリスケールの設定
  * 16.8.4 PreScale Register (TMR32B1PR)
  *----------------------------------------------------------------------*/
-#define	TIMER_PRE_SCALE		72000	// 1[KHz] = 0.001[sec]
+#define	TIMER_FREQ			1000000	// 1[MHz] = 0.000001[sec]
+
+/*----------------------------------------------------------------------
+ * 時刻 a が時刻 b より前か調べる（32ビットの時刻の桁あふれを考慮する）
+ * - 差が 2^31 未満であること（[msec]で約24日、TC の[μsec]で約35分）
+ *----------------------------------------------------------------------*/
+#define	TIMER_BEFORE(a, b)	((long)((unsigned long)(a) - (unsigned long)(b)) < 0)
+#define	TIMER_AFTER(a, b)	TIMER_BEFORE(b, a)
 
 /*----------------------------------------------------------------------
  * 関数のプロトタイプ宣言、関数へのNULLポインタ
  *----------------------------------------------------------------------*/
 extern void timerInit(void);
+extern int timerRunning(void);
 extern unsigned long timerRead(void);
+extern unsigned long long timerMicros(void);
+extern unsigned long long timerDeadline(unsigned long long usec);
+extern int timerExpired(unsigned long long deadline);
 extern void timerWakeup(unsigned long msec, void (*f)(void));
 
+/*----------------------------------------------------------------------
+ * サイクルカウンタ（DWT_CYCCNT）による計測と短時間の待機
+ * - メインクロックの切替に追従し、DWT がない場合はタイマーで代替する
+ * 使用例：
+ *	unsigned long c = timerCycles();
+ *	...	// 計測対象
+ *	c = timerCycles() - c;
+ *----------------------------------------------------------------------*/
+extern int timerCycleInit(void);
+extern unsigned long timerCycles(void);
+extern unsigned long timerCyclesToMicros(unsigned long cycles);
+extern void timerDelayUs(unsigned long usec);
+
+/*----------------------------------------------------------------------
+ * カウンタ／タイマーとマッチチャネルの資源管理
+ * - 各モジュールは初期化時に、使用するカウンタとチャネルを timerClaim() で確保する
+ * - カウンタの設定（TCR, PR, CTCR）は TMR_COUNTER の所有者だけが行い、
+ *   他のモジュールは空いているマッチチャネルだけを確保してカウンタを共有できる
+ * - MCR は timerMatchControl() で自分のチャネルのビットだけを変更する
+ *
+ *	        COUNTER  MR0          MR1          MR2    MR3          CAP0
+ *	CT16B0  pwm      pwm(MTR1)    pwm(周期割込) -      -            -
+ *	CT16B1  pwm      pwm(MTR2)    -            -      -            -
+ *	CT32B0  play     -            -            play   play(周期)    -
+ *	CT32B1  timer    timerWakeup  timerStart   -      timer(64bit) capture
+ *----------------------------------------------------------------------*/
+#define	TMR_16B0		0
+#define	TMR_16B1		1
+#define	TMR_32B0		2
+#define	TMR_32B1		3
+
+#define	TMR_MR0			(1<<0)	// マッチチャネル（MRn, MCR, EMR, PWMC の該当ビット）
+#define	TMR_MR1			(1<<1)
+#define	TMR_MR2			(1<<2)
+#define	TMR_MR3			(1<<3)
+#define	TMR_CAP0		(1<<4)	// キャプチャチャネル（CR0, CCR）
+#define	TMR_COUNTER		(1<<7)	// カウンタの設定（TCR, PR, CTCR）
+
+#define	TMR_MCR_I		(1<<0)	// 一致で割り込む
+#define	TMR_MCR_R		(1<<1)	// 一致で TC をリセットする
+#define	TMR_MCR_S		(1<<2)	// 一致で TC を停止する
+
+extern int timerClaim(int timer, unsigned char resources, const char *owner);
+extern void timerRelease(int timer, unsigned char resources, const char *owner);
+extern const char *timerOwner(int timer, unsigned char resource);
+extern int timerConflicts(void);
+extern void timerMatchControl(int timer, int ch, unsigned char mcr);
+
+/*----------------------------------------------------------------------
+ * キャプチャ入力（CT32B1_CAP0：PIO1_0）
+ * - エッジで TC（1[μsec]）を CR0 に取り込み、割込みハンドラから関数に渡す
+ * - PIO1_0 は右赤外線センサ（AD1）と共用のため、A/D変換とは同時に使えない
+ *   timerCaptureStop() で R_PIO1_0 を開始前の設定（AD1 など）に戻す
+ *----------------------------------------------------------------------*/
+#define	TIMER_CAP_RISING	(1<<0)	// 立上がりで取り込む
+#define	TIMER_CAP_FALLING	(1<<1)	// 立下がりで取り込む
+
+extern int timerCaptureStart(int edge, void (*f)(unsigned long tc));
+extern void timerCaptureStop(void);
+
+/*----------------------------------------------------------------------
+ * ソフトウェアタイマー
+ * - MR1 の1チャネルで、最大 TIMER_SLOTS 個のワンショット／周期タイマーを動作させる
+ * - timerWakeup() は Deep-sleep からの復帰（CT32B1_MAT0）のため MR0 を使用する
+ *----------------------------------------------------------------------*/
+#define	TIMER_SLOTS		8		// 同時に動作できるタイマーの数
+#define	TIMER_IN_ISR	0		// 割込みハンドラ内で実行する
+#define	TIMER_DEFERRED	1		// timerDispatch() で実行する
+
+extern int timerStart(unsigned long msec, unsigned long period, void (*f)(void), int mode);
+extern void timerStop(int id);
+extern int timerDispatch(void);
+
 /*----------------------------------------------------------------------
  * 指定時間[msec]の待機、待機のキャンセル
- * timerInit()が実行された場合は Hardware timer を使用する
+ * timerInit()が実行された場合は Hardware timer を使用し、WFI でスリープして待機する
  *----------------------------------------------------------------------*/
 extern void timerWait(unsigned long msec);
 extern void timerWaitCancel(void);
@@ -37,4 +121,12 @@ extern void timerWaitCancel(void);
  *----------------------------------------------------------------------*/
 #define	WAIT_FOREVER	(unsigned long)(-1)
 
+#ifdef	EXAMPLE
+/*===============================================================================
+ * ソフトウェアタイマーの動作確認
+ * - 複数タイマーの満了時刻からの遅れを負荷をかけて計測する
+ *===============================================================================*/
+extern void timerExample(void);
+#endif // EXAMPLE
+
 #endif /* _TIMER_H_ */
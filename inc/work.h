@@ -0,0 +1,31 @@
+/*===============================================================================
+ * Name        : work.h
+ * Author      : $(author)
+ * Version     :
+ * CPU type    : ARM Cortex-M3 LPC1343
+ * Copyright   : $(copyright)
+ * Description : Deferred-work queue definitions
+ *===============================================================================*/
+#ifndef _WORK_H_
+#define _WORK_H_
+
+/*----------------------------------------------------------------------
+ * 遅延実行キューの設定
+ * - 割込みハンドラから workPost() した関数を、workRun() でスレッドレベルで実行する
+ * - 投入された順（FIFO）に実行し、満杯の場合は投入に失敗する（workLost() で計数）
+ * - 割込みハンドラは投入だけで戻るため、実行時間が短く一定になる
+ * 使用例：
+ *	static void report(void) { ledOn(LED2); timerWait(250); }	// 時間のかかる処理
+ *	static void handler(void) { pwmEmergencyStop(); workPost(report); }	// 割込みハンドラ
+ *----------------------------------------------------------------------*/
+#define	WORK_SLOTS		16		// キューの大きさ（2のべき乗）
+
+/*----------------------------------------------------------------------
+ * 関数のプロトタイプ宣言
+ *----------------------------------------------------------------------*/
+extern int workPost(void (*f)(void));
+extern int workRun(void);
+extern int workPending(void);
+extern unsigned long workLost(void);
+
+#endif // _WORK_H_
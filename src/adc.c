@@ -54,6 +54,17 @@ void adcInit(void) {
 	LPC_IOCON->R_PIO1_0 &= 0x67; // 0110 0111: Analog input mode,  pull-up disable
 	LPC_IOCON->R_PIO1_0 |= 0x01; // Selects function PIO0_11
 
+#if	ADC_VBAT_ON
+	// 7.4.25 IOCON_PIO1_10
+	// I/O configuration for pin PIO1_10/AD6/CT16B1_MAT1 (Reset value: 0xD0 = 1101 0000)
+	// Bit 0:2 (FUNC)  : 001(Selects function AD6)
+	// Bit 4:3 (MODE)  : 00(No pull-down/pull-up resistor enabled)
+	// Bit   5 (HYS)   : 0(Hysteresis disable)
+	// Bit   7 (ADMODE): 0(Analog input mode)
+	LPC_IOCON->PIO1_10 &= 0x67; // 0110 0111: Analog input mode,  pull-up disable
+	LPC_IOCON->PIO1_10 |= 0x01; // Selects function AD6
+#endif
+
 	// 3.5.47 Power-down configuration register
 	// Bit 4 (ADC_PD): 0=Powered, 1=Powered down
 	LPC_SYSCON->PDRUNCFG &= ~(1<<4); // Disable Power down bit to the ADC block
@@ -71,6 +82,9 @@ void adcInit(void) {
 	(1<<0) |	// BURST = 0, only one channel can be selected
 #else
 	(3<<0) |	// BURST = 1, any numbers of channels can be selected
+#if	ADC_VBAT_ON
+	(1<<ADC_VBAT) |	// AD6: 電源電圧
+#endif
 #endif
 
 	// Bit 15:8 (CLKDIV): PCLK is divided by CLKDIV +1 to produce the clock for the ADC
@@ -97,8 +111,10 @@ void adcInit(void) {
 unsigned short adcRead(unsigned char ch) {
 	unsigned int DR; // Data Register
 
-	// A/D変換のチャネルは 0 あるいは 1 のみ
-	ch &= 0x01;
+	// A/D変換のチャネルは 0、1 あるいは電源電圧のみ
+	if (ch != ADC_VBAT) {
+		ch &= 0x01;
+	}
 
 #if	(ADC_MODE == ADC_MODE_SINGLE)
 
@@ -113,6 +129,9 @@ unsigned short adcRead(unsigned char ch) {
 	  case ADC_LEFT:
 		while (!((DR = LPC_ADC->DR0) & ADC_DONE));
 		break;
+	  case ADC_VBAT:
+		while (!((DR = LPC_ADC->DR6) & ADC_DONE));
+		break;
 	  case ADC_RIGHT:
 	  default:
 		while (!((DR = LPC_ADC->DR1) & ADC_DONE));
@@ -133,6 +152,9 @@ unsigned short adcRead(unsigned char ch) {
 	  case ADC_LEFT:
 		DR = LPC_ADC->DR0;
 		break;
+	  case ADC_VBAT:
+		DR = LPC_ADC->DR6;
+		break;
 	  case ADC_RIGHT:
 	  default:
 		DR = LPC_ADC->DR1;
@@ -162,6 +184,15 @@ inline void adcRead2(unsigned short *L, unsigned short *R) {
 #endif // ADC_MODE
 }
 
+/*----------------------------------------------------------------------
+ * A/D変換 - 電源電圧[mV]の読み込み
+ *----------------------------------------------------------------------*/
+unsigned short adcReadVoltage(void) {
+	unsigned long v = adcRead(ADC_VBAT);
+
+	return (unsigned short) ((v * ADC_VREF * ADC_VBAT_DIVIDER) >> 10);
+}
+
 #ifdef	EXAMPLE
 /*===============================================================================
  * A/D変換の動作確認
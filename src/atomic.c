@@ -0,0 +1,228 @@
+/*===============================================================================
+ * Name        : atomic.c
+ * Author      : $(author)
+ * Version     :
+ * CPU type    : ARM Cortex-M3 LPC1343
+ * Copyright   : $(copyright)
+ * Description : Lock-free SPSC ring buffers for ISR/main data exchange
+ *===============================================================================*/
+// Cortex Microcontroller Software Interface Standard
+#ifdef __USE_CMSIS
+#include "LPC13xx.h"
+#endif
+
+#include "type.h"
+#include "atomic.h"
+
+/*----------------------------------------------------------------------
+ * Atomic debug configuration
+ *----------------------------------------------------------------------*/
+#define	ATOMIC_DEBUG	0
+#if		ATOMIC_DEBUG
+#include <stdio.h>
+#include "sci.h"
+#else
+#define	sciPrintf(...)
+#endif
+
+/*----------------------------------------------------------------------
+ * リングバッファへの書き込み（書き込み側から呼び出す）
+ * - 戻り値は 0: 成功、-1: 満杯
+ *----------------------------------------------------------------------*/
+int spscPut(Spsc_t *q, const void *data) {
+	unsigned long head = q->head;
+	const unsigned char *src = data;
+	unsigned char *dst;
+	int i;
+
+	if (head - q->tail >= q->size) {
+		return -1;
+	}
+
+	dst = q->buf + (head & (q->size - 1)) * q->elem;
+	for (i = 0; i < q->elem; i++) {
+		dst[i] = src[i];
+	}
+
+	// 要素を書き終えてから、読み出し側に公開する
+	atomicBarrier();
+	q->head = head + 1;
+
+	return 0;
+}
+
+/*----------------------------------------------------------------------
+ * リングバッファからの読み出し（読み出し側から呼び出す）
+ * - 戻り値は 0: 成功、-1: 空
+ *----------------------------------------------------------------------*/
+int spscGet(Spsc_t *q, void *data) {
+	unsigned long tail = q->tail;
+	const unsigned char *src;
+	unsigned char *dst = data;
+	int i;
+
+	if (q->head == tail) {
+		return -1;
+	}
+
+	// head の読み出しより後で、要素を読み出す
+	atomicBarrier();
+
+	src = q->buf + (tail & (q->size - 1)) * q->elem;
+	for (i = 0; i < q->elem; i++) {
+		dst[i] = src[i];
+	}
+
+	// 要素を読み終えてから、書き込み側に領域を返す
+	atomicBarrier();
+	q->tail = tail + 1;
+
+	return 0;
+}
+
+/*----------------------------------------------------------------------
+ * リングバッファの格納数
+ *----------------------------------------------------------------------*/
+int spscCount(Spsc_t *q) {
+	return (int) (q->head - q->tail);
+}
+
+#ifdef	EXAMPLE
+/*===============================================================================
+ * 不可分操作とリングバッファの動作確認
+ * - 1[msec]周期のタイマー割込みとメイン処理から、共有する変数を同時に操作する
+ * - 結果が正しければ LED1、誤りがあれば LED2 を点灯する
+ *
+ * 【EXAMPLE1】加算の競合
+ *	atomicInc() による加算は欠けず、通常の加算（++）は割込みと重なった分だけ欠ける
+ *
+ * 【EXAMPLE2】リングバッファの受け渡し
+ *	割込みハンドラが連番を書き込み、メイン処理が読み出して欠落や順序の誤りを調べる
+ *	満杯で書き込めなかった連番は、次に書き込めた値から読み飛ばす
+ *===============================================================================*/
+#include "timer.h"
+#include "gpio.h"
+
+#define	ATOMIC_LOOP		1000000	// メイン処理の加算回数
+#define	ATOMIC_BURST	100		// 1回の割込みでの加算回数
+#define	SPSC_BURST		8		// 1回の割込みでの書き込み数
+#define	SPSC_TIME		10000	// 受け渡しを続ける時間[msec]
+
+static Atomic_t atomicCount = 0;			// atomicInc() で加算する
+static volatile unsigned long plainCount = 0;	// ++ で加算する
+static volatile unsigned long isrCount = 0;	// 割込みハンドラでの加算回数
+
+SPSC_DEFINE(seqQueue, unsigned long, 16);
+static unsigned long seqNext = 0;			// 次に書き込む連番
+static volatile unsigned long seqDrop = 0;	// 満杯で書き込めなかった数
+
+/*----------------------------------------------------------------------
+ * 動作例1: 加算の競合
+ *----------------------------------------------------------------------*/
+static void countBurst(void) {
+	int i;
+
+	for (i = 0; i < ATOMIC_BURST; i++) {
+		atomicInc(&atomicCount);
+		plainCount++;
+	}
+	isrCount += ATOMIC_BURST;
+}
+
+static void atomicExample1(void) {
+	unsigned long i, expected;
+	int id;
+
+	id = timerStart(1, 1, countBurst, TIMER_IN_ISR);
+
+	for (i = 0; i < ATOMIC_LOOP; i++) {
+		atomicInc(&atomicCount);
+		plainCount++;
+	}
+
+	timerStop(id);
+
+	expected = ATOMIC_LOOP + isrCount;
+	sciPrintf("expected = %ld, atomic = %ld, plain = %ld (lost %ld)\r\n",
+		expected, atomicLoad(&atomicCount), plainCount, expected - plainCount);
+
+	ledOn(atomicLoad(&atomicCount) == expected ? LED1 : LED2);
+	while (1);
+}
+
+/*----------------------------------------------------------------------
+ * 動作例2: リングバッファの受け渡し
+ *----------------------------------------------------------------------*/
+static void seqBurst(void) {
+	int i;
+
+	for (i = 0; i < SPSC_BURST; i++, seqNext++) {
+		if (spscPut(&seqQueue, &seqNext) < 0) {
+			seqDrop++;
+		}
+	}
+}
+
+static void atomicExample2(void) {
+	unsigned long seq, expect = 0, got = 0, error = 0;
+	unsigned long long deadline;
+	int id;
+
+	id = timerStart(1, 1, seqBurst, TIMER_IN_ISR);
+	deadline = timerDeadline((unsigned long long)SPSC_TIME * 1000);
+
+	while (!timerExpired(deadline)) {
+		while (spscGet(&seqQueue, &seq) == 0) {
+			// 書き込めなかった分だけ進むことはあっても、戻ることはない
+			if (seq < expect) {
+				error++;
+			}
+			expect = seq + 1;
+			got++;
+		}
+
+		// 読み出しを遅らせ、満杯になる場合も確認する
+		timerDelayUs(got & 0x3FF);
+	}
+
+	timerStop(id);
+
+	// 書き込んだ数 = 読み出した数 + 満杯で書き込めなかった数 + 残り
+	if (seqNext != got + seqDrop + spscCount(&seqQueue)) {
+		error++;
+	}
+
+	sciPrintf("put = %ld, get = %ld, drop = %ld, error = %ld\r\n", seqNext, got, seqDrop, error);
+
+	ledOn(error ? LED2 : LED1);
+	while (1);
+}
+
+/*----------------------------------------------------------------------
+ * 不可分操作とリングバッファの動作例
+ * - exampleType
+ *	1: 割込みハンドラとメイン処理による加算の競合
+ *	2: リングバッファの受け渡し
+ *----------------------------------------------------------------------*/
+void atomicExample(int exampleType) {
+	timerInit();	// timerStart()
+	gpioInit();		// ledOn()
+	timerCycleInit();
+
+#if	ATOMIC_DEBUG
+	sciInit();		// PIO0_3がUSB_VBUSと競合するため、LED1（橙）点灯せず
+	swStandby();	// 通信の確立を確認し、SW1で動作を開始する
+#endif
+
+	switch (exampleType) {
+	  case 1:
+		atomicExample1();
+		break;
+
+	  case 2:
+	  default:
+		atomicExample2();
+		break;
+	}
+}
+#endif // EXAMPLE
@@ -12,8 +12,10 @@
 #endif
 
 #include "type.h"
+#include "clk.h"
 #include "gpio.h"
 #include "timer.h"
+#include "atomic.h"
 
 /*----------------------------------------------------------------------
  * 9.4.2　GPIO data direction register (GPIO0DIR)
@@ -47,17 +49,20 @@ unsigned char gpioGetBit(__IO LPC_GPIO_TypeDef* port, uint32_t bit) {
  * 割込み処理用テーブル
  *----------------------------------------------------------------------*/
 static GPIO_IRQ_t irqTable[4] = {
-	{LPC_GPIO0, EINT0_IRQn, 0, 0},
-	{LPC_GPIO1, EINT1_IRQn, 0, 0},
-	{LPC_GPIO2, EINT2_IRQn, 0, 0},
-	{LPC_GPIO3, EINT3_IRQn, 0, 0},
+	{LPC_GPIO0, EINT0_IRQn, 0, 0, {0}},
+	{LPC_GPIO1, EINT1_IRQn, 0, 0, {0}},
+	{LPC_GPIO2, EINT2_IRQn, 0, 0, {0}},
+	{LPC_GPIO3, EINT3_IRQn, 0, 0, {0}},
 };
 
+static GPIO_IRQStat_t irqStat[4];
+
 /*----------------------------------------------------------------------
  * 外部入力ピンによる割り込みの監視と処理の設定
  * - 制約事項
- *   ・ 1つのポートに設定できる割り込みの監視は1つのピンのみ
  *   ・ すぐに割り込みを許可するため、指定ポートのピンを「入力」に設定しておくこと
+ * - 同じポートの他のピンの設定はそのまま残る
+ * - f = 0 でも割込みは監視する（スリープからの復帰のみに使う場合など）
  *
  * Definition General Purpose Input/Output (GPIO) in LPC13xx.h
  * typedef struct {
@@ -93,9 +98,24 @@ static GPIO_IRQ_t irqTable[4] = {
  * HIGH         1          -          1
  *----------------------------------------------------------------------*/
 void gpioSetInterrupt(uint32_t portNo, uint32_t pin, uint8_t mode, void (*f)(void)) {
-	__IO LPC_GPIO_TypeDef* port = irqTable[portNo].port;
+	GPIO_IRQ_t *irq;
+	__IO LPC_GPIO_TypeDef* port;
+	CritState_t cs;
+
+	if (portNo >= 4 || pin >= GPIO_PINS) {
+		return;
+	}
+	irq  = &irqTable[portNo];
+	port = irq->port;
 
-	switch (mode) {
+	// 割込みハンドラも IE を更新する（INT_MODE_ONESHOT）ため、ポートの割込みを禁止して
+	// 読み出し～更新～書き込みを行う
+	cs = critEnterIRQ(irq->irqNo);
+
+	// 設定中に割り込まないよう、先にピンの割込みを止める
+	port->IE &= ~(1 << pin);
+
+	switch (mode & ~INT_MODE_ONESHOT) {
 	  case INT_MODE_RISING:
 		port->IS  &= ~(1 << pin);
 		port->IBE &= ~(1 << pin);
@@ -119,53 +139,144 @@ void gpioSetInterrupt(uint32_t portNo, uint32_t pin, uint8_t mode, void (*f)(voi
 		port->IEV |=  (1 << pin);
 		break;
 	  default:
+		critExitIRQ(irq->irqNo, cs);
 		return;
 	}
 
+	critExitIRQ(irq->irqNo, cs);
+
+	// 監視するピンと実行する関数を登録
+	cs = critEnter();
+	irq->function[pin] = f;
+	irq->pins |= (1 << pin);
+	if (mode & INT_MODE_ONESHOT) {
+		irq->oneshot |=  (1 << pin);
+	} else {
+		irq->oneshot &= ~(1 << pin);
+	}
+	critExit(cs);
+
+	gpioEnableInterrupt(portNo, pin);
+
+	// IRQn_Type is defined in LPC13xx.h
+	NVIC_EnableIRQ(irq->irqNo);
+}
+
+/*----------------------------------------------------------------------
+ * 登録済みのピンの割込みの再開（INT_MODE_ONESHOT で止まったピンなど）
+ *----------------------------------------------------------------------*/
+void gpioEnableInterrupt(uint32_t portNo, uint32_t pin) {
+	__IO LPC_GPIO_TypeDef* port;
+	CritState_t cs;
+
+	if (portNo >= 4 || pin >= GPIO_PINS || !(irqTable[portNo].pins & (1 << pin))) {
+		return;
+	}
+	port = irqTable[portNo].port;
+
+	// 割込みハンドラによる IE の更新と競合しないよう、ポートの割込みを禁止する
+	cs = critEnterIRQ(irqTable[portNo].irqNo);
+
+	// 9.4.9 GPIO interrupt clear register (GPIO0IC)
+	// 1 = Clears edge detection logic for pin PIOn_x.
+	// 止めている間に検出したエッジは捨てる
+	port->IC = (1 << pin);
+
 	// 9.4.6 GPIO interrupt mask register (GPIO0IE)
 	// 1 = Interrupt on pin PIOn_x is not masked.
 	port->IE |= (1 << pin);
 
-	// 9.4.9 GPIO interrupt clear register (GPIO0IC)
-	// 1 = Clears edge detection logic for pin PIOn_x.
-	port->IC |= (1 << pin);
+	critExitIRQ(irqTable[portNo].irqNo, cs);
+}
 
-	// 監視するビットと実行する関数を登録
-	irqTable[portNo].pin = pin;
-	irqTable[portNo].function = f;
+/*----------------------------------------------------------------------
+ * ピンの割込みの停止と登録の解除
+ * - ポートの全ピンの登録を解除したら、NVIC の割込みも禁止する
+ *----------------------------------------------------------------------*/
+void gpioDisableInterrupt(uint32_t portNo, uint32_t pin) {
+	GPIO_IRQ_t *irq;
+	CritState_t cs;
 
-	// IRQn_Type is defined in LPC13xx.h
-	NVIC_EnableIRQ(irqTable[portNo].irqNo);
+	if (portNo >= 4 || pin >= GPIO_PINS) {
+		return;
+	}
+	irq = &irqTable[portNo];
+
+	// 9.4.6 GPIO interrupt mask register (GPIO0IE)
+	// 0 = Interrupt on pin PIOn_x is masked.
+	// 割込みハンドラによる IE の更新と競合しないよう、ポートの割込みを禁止する
+	cs = critEnterIRQ(irq->irqNo);
+	irq->port->IE &= ~(1 << pin);
+	critExitIRQ(irq->irqNo, cs);
+
+	cs = critEnter();
+	irq->pins    &= ~(1 << pin);
+	irq->oneshot &= ~(1 << pin);
+	irq->function[pin] = 0;
+	critExit(cs);
+
+	if (!irq->pins) {
+		NVIC_DisableIRQ(irq->irqNo);
+	}
 }
 
 /*----------------------------------------------------------------------
  * 外部割込みの処理
+ * - 発生したピンをまとめてクリアしてから関数を呼び出し、実行中のエッジも取りこぼさない
+ * - レベル割込みのピンは、要因を取り除くまで割込みが続く
  *----------------------------------------------------------------------*/
+#define	GPIO_IRQ_STAT	1	// 1: 割込みの処理統計をとる
+
+static volatile int capPort = -1;	// エッジ時刻を記録するポート（-1: なし）
+static volatile int capPin  = -1;	// エッジ時刻を記録するピン
+static void captureRecord(unsigned long edge, unsigned long now);
+
 static void irqHandler(int portNo) {
-	__IO LPC_GPIO_TypeDef *port = irqTable[portNo].port;
+	GPIO_IRQ_t *irq = &irqTable[portNo];
+	__IO LPC_GPIO_TypeDef *port = irq->port;
+	uint32_t mis, pin;
+#if	GPIO_IRQ_STAT
+	unsigned long entry = timerCycles();
+#endif
 
-	// 9.4.7 GPIO raw interrupt status register (GPIO0RIS)
-	// 1 = Interrupt requirements met on PIOn_x.
-	if (port->RIS & (1 << irqTable[portNo].pin)) {
-		// チャタリングによる多重割り込みを防止する
-		NVIC_DisableIRQ(irqTable[portNo].irqNo);
+	// 9.4.8 GPIO masked interrupt status register (GPIO0MIS)
+	// 1 = Interrupt requirements met on PIOn_x and not masked.
+	mis = port->MIS;
 
-		// 登録された関数を呼び出す
-		if (irqTable[portNo].function) {
-			irqTable[portNo].function();
-		}
+	// 9.4.9 GPIO interrupt clear register (GPIO0IC)
+	// 1 = Clears edge detection logic for pin PIOn_x.
+	port->IC = mis;
 
-		// 9.4.9 GPIO interrupt clear register (GPIO0IC)
-		// 1 = Clears edge detection logic for pin PIOn_x.
-		port->IC |= (1 << irqTable[portNo].pin);
+	// INT_MODE_ONESHOT のピンはチャタリングによる多重割り込みを防止する
+	if (mis & irq->oneshot) {
+		port->IE &= ~(mis & irq->oneshot);
+	}
 
-		// Remark: The synchronizer between the GPIO and the NVIC blocks
-		// causes a delay of 2 clocks. It is recommended to add two NOPs
-		// after the clear of the interrupt edge detection logic before
-		// the exit of the interrupt service routine.
-		__NOP();
-		__NOP();
+	// 発生したピンを番号の大きい順に取り出す
+	// ARMv7-M Architecture Reference Manual A6.7.21 CLZ
+	while (mis) {
+		pin = 31 - __builtin_clz(mis);
+		mis &= ~(1 << pin);
+
+		if (irq->function[pin]) {
+#if	GPIO_IRQ_STAT
+			unsigned long latency = timerCycles() - entry;
+			irqStat[portNo].count++;
+			irqStat[portNo].maxLatency = MAX(irqStat[portNo].maxLatency, latency);
+			if (portNo == capPort && (int)pin == capPin) {
+				captureRecord(entry, entry + latency);
+			}
+#endif
+			irq->function[pin]();
+		}
 	}
+
+	// Remark: The synchronizer between the GPIO and the NVIC blocks
+	// causes a delay of 2 clocks. It is recommended to add two NOPs
+	// after the clear of the interrupt edge detection logic before
+	// the exit of the interrupt service routine.
+	__NOP();
+	__NOP();
 }
 
 /*----------------------------------------------------------------------
@@ -176,6 +287,122 @@ void PIOINT1_IRQHandler(void) { irqHandler(1); }
 void PIOINT2_IRQHandler(void) { irqHandler(2); }
 void PIOINT3_IRQHandler(void) { irqHandler(3); }
 
+/*----------------------------------------------------------------------
+ * 外部割込みの処理統計の取得
+ *----------------------------------------------------------------------*/
+void gpioInterruptStat(uint32_t portNo, GPIO_IRQStat_t *stat) {
+	if (portNo < 4 && stat) {
+		CritState_t cs = critEnter();
+		*stat = irqStat[portNo];
+		critExit(cs);
+	}
+}
+
+/*----------------------------------------------------------------------
+ * エッジ時刻の記録（キャプチャモード）
+ *----------------------------------------------------------------------*/
+static GPIO_CaptureStat_t capStat;
+static void (*capFunc)(void) = 0;		// キャプチャ入力のエッジで呼び出す関数
+static unsigned long capCyclesPerTick;	// TC の1カウント当たりのサイクル数
+
+static void captureRecord(unsigned long edge, unsigned long now) {
+	unsigned long latency = now - edge;
+	int bin = latency ? 32 - __builtin_clz(latency) : 0;
+
+	capStat.edges++;
+	capStat.lastEdge = edge;
+	capStat.maxLatency = MAX(capStat.maxLatency, latency);
+	capStat.hist[MIN(bin, GPIO_CAPTURE_BINS - 1)]++;
+}
+
+/*----------------------------------------------------------------------
+ * キャプチャ入力のエッジ（TIMER32_1_IRQHandler() から呼び出される）
+ * - 取り込んだ TC から現在までのカウントをサイクル数に換算し、エッジ時刻を求める
+ *----------------------------------------------------------------------*/
+static void captureHardware(unsigned long tc) {
+	unsigned long now = timerCycles();
+
+	captureRecord(now - (LPC_TMR32B1->TC - tc) * capCyclesPerTick, now);
+
+	if (capFunc) {
+		capFunc();
+	}
+}
+
+/*----------------------------------------------------------------------
+ * エッジ時刻の記録の開始（戻り値 1: キャプチャ入力、0: 割込みハンドラ、-1: 失敗）
+ * - mode: INT_MODE_FALLING, INT_MODE_RISING, INT_MODE_CHANGE
+ * - f: エッジごとに呼び出す関数（割込みハンドラから呼び出される）
+ * - 割込みハンドラを登録済みのピン（SW1 など）は、その処理を奪わないよう失敗とする
+ *----------------------------------------------------------------------*/
+int gpioCapture(uint32_t portNo, uint32_t pin, uint8_t mode, void (*f)(void)) {
+	const int edge[] = {
+		TIMER_CAP_FALLING,						// INT_MODE_FALLING
+		TIMER_CAP_RISING,						// INT_MODE_RISING
+		TIMER_CAP_RISING | TIMER_CAP_FALLING,	// INT_MODE_CHANGE
+	};
+	static const GPIO_CaptureStat_t zero = {0};
+
+	if (portNo >= 4 || pin >= GPIO_PINS || (mode & 0x7F) > INT_MODE_CHANGE) {
+		return -1;
+	}
+
+	gpioCaptureStop();
+
+	if (irqTable[portNo].pins & (1 << pin)) {
+		return -1;
+	}
+
+	capStat = zero;
+	capFunc = f;
+
+	// PIO1_0: CT32B1_CAP0 で取り込む
+	if (portNo == 1 && pin == 0) {
+		capCyclesPerTick = MAX(clkGetMainClock() / TIMER_FREQ, 1);
+		if (timerCaptureStart(edge[mode & 0x7F], captureHardware) == 0) {
+			capStat.hardware = TRUE;
+			return 1;
+		}
+	}
+
+#if	GPIO_IRQ_STAT
+	capPort = portNo;
+	capPin  = pin;
+	gpioSetInterrupt(portNo, pin, mode, f);
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+/*----------------------------------------------------------------------
+ * エッジ時刻の記録の停止
+ *----------------------------------------------------------------------*/
+void gpioCaptureStop(void) {
+	if (capStat.hardware) {
+		timerCaptureStop();
+		capStat.hardware = FALSE;
+	}
+
+	if (capPort >= 0) {
+		gpioDisableInterrupt(capPort, capPin);
+		capPort = capPin = -1;
+	}
+
+	capFunc = 0;
+}
+
+/*----------------------------------------------------------------------
+ * エッジ時刻の記録と遅延の分布の取得
+ *----------------------------------------------------------------------*/
+void gpioCaptureStat(GPIO_CaptureStat_t *stat) {
+	if (stat) {
+		CritState_t cs = critEnter();
+		*stat = capStat;
+		critExit(cs);
+	}
+}
+
 /*----------------------------------------------------------------------
  * GPIOの初期化
  *----------------------------------------------------------------------*/
@@ -186,29 +413,36 @@ void gpioInit(void) {
 //	LPC_IOCON->PIO0_1 = ((0<<0) | (1<<3));		// PIO0 ビット1（SW1）をプルアップに設定 --> ハードウェアで対応済み
 }
 
+/*----------------------------------------------------------------------
+ * LEDの点灯データ（LED_OFF ～ LED_ON）に対するポートの出力値（Low active）
+ * - LED1、LED2 を GPIO_PINS_LED への1回の書き込みで更新する
+ *----------------------------------------------------------------------*/
+static const unsigned long ledPinData[4] = {
+	GPIO_MASK(GPIO_BIT_LED1) | GPIO_MASK(GPIO_BIT_LED2),	// LED_OFF
+	GPIO_MASK(GPIO_BIT_LED2),								// LED1
+	GPIO_MASK(GPIO_BIT_LED1),								// LED2
+	0,														// LED_ON
+};
+
 /*----------------------------------------------------------------------
  * LEDの点灯／消灯
  *----------------------------------------------------------------------*/
 void ledOn(unsigned char led) {
-	gpioSetBit(LPC_GPIO0, GPIO_BIT_LED1, !(led & LED1));	// Low active
-	gpioSetBit(LPC_GPIO0, GPIO_BIT_LED2, !(led & LED2));	// Low active
+	gpioPinWrite(GPIO_PINS_LED, ledPinData[led & LED_ON]);
 }
 
 void ledOff(unsigned char led) {
-	gpioSetBit(LPC_GPIO0, GPIO_BIT_LED1, !(~led & LED1));	// Low active
-	gpioSetBit(LPC_GPIO0, GPIO_BIT_LED2, !(~led & LED2));	// Low active
+	gpioPinWrite(GPIO_PINS_LED, ledPinData[~led & LED_ON]);
 }
 
 /*----------------------------------------------------------------------
  * LEDの点灯を反転する
+ * - 反転するLEDのビットだけをマスクに選び、1回の書き込みで更新する
  *----------------------------------------------------------------------*/
 void ledToggle(unsigned char led) {
-	if (led & LED1) {
-		gpioSetBit(LPC_GPIO0, GPIO_BIT_LED1, !gpioGetBit(LPC_GPIO0, GPIO_BIT_LED1));
-	}
-	if (led & LED2) {
-		gpioSetBit(LPC_GPIO0, GPIO_BIT_LED2, !gpioGetBit(LPC_GPIO0, GPIO_BIT_LED2));
-	}
+	unsigned long mask = ledPinData[~led & LED_ON];
+
+	gpioMaskedWrite(LPC_GPIO0, mask, ~gpioMaskedRead(LPC_GPIO0, mask));
 }
 
 /*----------------------------------------------------------------------
@@ -228,30 +462,224 @@ void ledBlink(unsigned long msec) {
 }
 
 /*----------------------------------------------------------------------
- * スイッチ状態（low active）をスキャンする
+ * LEDの点灯パターン
+ * - 表示中のパターンだけがソフトウェアタイマーで進む
+ * - 上位のパターンで中断された下位のパターンは、上位が終わると中断した要素から再開する
+ * - 状態はタイマーの割込みハンドラと共有するため、TIMER32_1 の割込みだけを禁止して更新する
+ *----------------------------------------------------------------------*/
+typedef struct {
+	const LedPattern_t *pattern;	// 0: なし
+	unsigned char step;				// 表示中の要素
+	unsigned char count;			// 繰り返した回数
+} LedSlot_t;
+
+static LedSlot_t ledSlot[LED_PRIO_LEVELS];
+static volatile int ledActive = -1;		// 表示中の優先度（-1: ledShow() の点灯データ）
+static int ledTimer = -1;				// 次の要素に進めるタイマー
+static volatile unsigned char ledBase = LED_OFF;	// パターンがないときの点灯データ
+
+static void ledNext(void);
+
+static void ledUpdate(void) {
+	const LedStep_t *s;
+	int i;
+
+	if (ledTimer >= 0) {
+		timerStop(ledTimer);
+		ledTimer = -1;
+	}
+
+	for (i = LED_PRIO_LEVELS - 1; i >= 0 && !ledSlot[i].pattern; i--);
+	ledActive = i;
+
+	if (i < 0) {
+		ledOn(ledBase);
+		return;
+	}
+
+	s = &ledSlot[i].pattern->step[ledSlot[i].step];
+	ledOn(s->led);
+
+	// タイマーが動いていなければ最初の要素を表示したままとする
+	if (timerRunning()) {
+		ledTimer = timerStart(s->msec, 0, ledNext, TIMER_IN_ISR);
+	}
+}
+
+static void ledNext(void) {
+	LedSlot_t *s;
+
+	ledTimer = -1;
+	if (ledActive < 0) {
+		return;
+	}
+
+	s = &ledSlot[ledActive];
+	if (++s->step >= s->pattern->steps) {
+		s->step = 0;
+		if (s->pattern->repeat && ++s->count >= s->pattern->repeat) {
+			s->pattern = 0;
+		}
+	}
+
+	ledUpdate();
+}
+
+/*----------------------------------------------------------------------
+ * 点灯パターンを指定した優先度で開始する（戻り値 0: 成功、-1: 優先度の誤り）
+ *----------------------------------------------------------------------*/
+int ledPlay(const LedPattern_t *p, int prio) {
+	CritState_t c;
+
+	if (prio < 0 || prio >= LED_PRIO_LEVELS || !p || !p->steps) {
+		return -1;
+	}
+
+	c = critEnterIRQ(TIMER_32_1_IRQn);
+	ledSlot[prio].pattern = p;
+	ledSlot[prio].step    = 0;
+	ledSlot[prio].count   = 0;
+	if (prio >= ledActive) {
+		ledUpdate();
+	}
+	critExitIRQ(TIMER_32_1_IRQn, c);
+
+	return 0;
+}
+
+/*----------------------------------------------------------------------
+ * 指定した優先度の点灯パターンを停止する
+ *----------------------------------------------------------------------*/
+void ledCancel(int prio) {
+	CritState_t c;
+
+	if (prio < 0 || prio >= LED_PRIO_LEVELS) {
+		return;
+	}
+
+	c = critEnterIRQ(TIMER_32_1_IRQn);
+	ledSlot[prio].pattern = 0;
+	if (prio == ledActive) {
+		ledUpdate();
+	}
+	critExitIRQ(TIMER_32_1_IRQn, c);
+}
+
+/*----------------------------------------------------------------------
+ * パターンがないときの点灯データを設定する
+ * - 制御周期ごとに呼び出せるよう、変化したときだけ出力する
+ *----------------------------------------------------------------------*/
+void ledShow(unsigned char led) {
+	CritState_t c;
+
+	if (led != ledBase) {
+		c = critEnterIRQ(TIMER_32_1_IRQn);
+		ledBase = led;
+		if (ledActive < 0) {
+			ledOn(led);
+		}
+		critExitIRQ(TIMER_32_1_IRQn, c);
+	}
+}
+
+/*----------------------------------------------------------------------
+ * スイッチのチャタリング除去
+ * - SW1 の両エッジ割込みのたびに WAIT_CHATTERING のワンショットタイマーを掛け直し、
+ *   エッジが途絶えて満了した時点のピンの状態を確定した状態とする
+ * - 確定した状態とクリック（押されてから離された）回数をバックグラウンドで保持するため、
+ *   swScan(), swClick() は待機せずに結果を返す
+ * - timerInit() の前は、従来どおり WAIT_CHATTERING 待機して判定する
  *----------------------------------------------------------------------*/
 #define WAIT_CHATTERING	50 // チャタリング除去の待機時間[msec]
 
+static volatile unsigned char swReady = FALSE;	// 1: バックグラウンドで監視中
+static volatile unsigned char swState = SW_OFF;	// 確定した状態
+static volatile int swTimer = -1;				// チャタリング除去のタイマー
+static Atomic_t swClicks = 0;					// 未取得のクリック回数
+static void (*swWatchFunc)(void) = 0;			// 離された時に実行する関数
+
+// PIO0_1：SW1（'L'：押されている、'H'：離されている）
+#define	swPin()	(gpioGetBit(LPC_GPIO0, GPIO_BIT_SW1) ? SW_OFF : SW_ON)
+
+static void swGesture(unsigned char state);
+
+/*----------------------------------------------------------------------
+ * エッジが途絶えてから WAIT_CHATTERING 経過した時点で状態を確定する
+ *----------------------------------------------------------------------*/
+static void swSettle(void) {
+	unsigned char s = swPin();
+
+	swTimer = -1;
+
+	if (s != swState) {
+		swState = s;
+
+		// 離された（ON→OFF）
+		if (s == SW_OFF) {
+			atomicInc(&swClicks);
+			if (swWatchFunc) {
+				swWatchFunc();
+			}
+		}
+
+		swGesture(s);
+	}
+}
+
+/*----------------------------------------------------------------------
+ * SW1 のエッジ割込み - チャタリング除去のタイマーを掛け直す
+ *----------------------------------------------------------------------*/
+static void swEdge(void) {
+	if (swTimer >= 0) {
+		timerStop(swTimer);
+	}
+	swTimer = timerStart(WAIT_CHATTERING, 0, swSettle, TIMER_IN_ISR);
+}
+
+/*----------------------------------------------------------------------
+ * バックグラウンドでの監視を開始する（timerInit() の後であること）
+ *----------------------------------------------------------------------*/
+static int swStart(void) {
+	if (!swReady && timerRunning()) {
+		swState = swPin();
+		gpioSetInterrupt(0, GPIO_BIT_SW1, INT_MODE_CHANGE, swEdge);
+		swReady = TRUE;
+	}
+
+	return swReady;
+}
+
+/*----------------------------------------------------------------------
+ * スイッチ状態（low active）をスキャンする
+ * - swScan() で状態を監視している間の押下は、swClick() のクリックとして残さない
+ *----------------------------------------------------------------------*/
 int swScan(void) {
+	if (swStart()) {
+		atomicStore(&swClicks, 0);
+		return swState;
+	}
+
 	while (1) {
-		// PIO0_1： SW1
-		unsigned char c = gpioGetBit(LPC_GPIO0, GPIO_BIT_SW1);
+		unsigned char c = swPin();
 
 		// チャタリング除去
 		timerWait(WAIT_CHATTERING);
 
-		if (c == gpioGetBit(LPC_GPIO0, GPIO_BIT_SW1)) {
-			// 'L'：押されている
-			// 'H'：離されている
-			return c ? SW_OFF : SW_ON;
+		if (c == swPin()) {
+			return c;
 		}
 	}
 }
 
 /*----------------------------------------------------------------------
- * スイッチ状態（low active）をスキャンしON→OFFの立下りを検知する
+ * スイッチがクリック（ON→OFF）されたかを調べる
+ * - 前回の呼び出し以降にクリックされていれば SW_ON を返す
  *----------------------------------------------------------------------*/
 int swClick(void) {
+	if (swStart()) {
+		return atomicDecIfPositive(&swClicks) ? SW_ON : SW_OFF;
+	}
+
 	// スイッチが押されているかスキャンする
 	if (swScan() == SW_ON) {
 		// 押されている間はループ
@@ -277,10 +705,119 @@ int swStandby(void) {
 }
 
 /*----------------------------------------------------------------------
- * スイッチの立ち上がりエッジ（押されてから離された時）で実行する関数を登録する
+ * スイッチが押されてから離された時に実行する関数を登録する
+ * - 関数はタイマーの割込みハンドラから呼び出される
+ * - 監視中はエッジ割込みでスリープから復帰する
  *----------------------------------------------------------------------*/
 void swWatch(void (*f)(void)) {
-	gpioSetInterrupt(0, GPIO_BIT_SW1, INT_MODE_RISING, f);
+	swWatchFunc = f;
+
+	// timerInit() の前は、エッジ割込みから直接1回だけ呼び出す
+	if (!swStart()) {
+		gpioSetInterrupt(0, GPIO_BIT_SW1, INT_MODE_RISING | INT_MODE_ONESHOT, f);
+	}
+}
+
+/*----------------------------------------------------------------------
+ * スイッチ操作（ジェスチャー）の認識
+ * - チャタリング除去後の押下／解放と、ソフトウェアタイマーの満了から操作を判定する
+ *	・SW_EVT_CLICK : 離してから SW_DOUBLE_TIME 以内に次の押下がない
+ *	・SW_EVT_DOUBLE: 離してから SW_DOUBLE_TIME 以内に再び押し、長押しにならずに離した
+ *	・SW_EVT_LONG  : 押し続けて SW_LONG_TIME 経過するごと（n = 1, 2, ...）
+ *	                 2回目の押下が長押しになった場合は、先に1回目の SW_EVT_CLICK を通知する
+ *	・SW_EVT_HOLD  : SW_EVT_LONG の後で離した（n = 最後の SW_EVT_LONG の n）
+ * - イベントはキュー（swGetEvent()）に積み、登録された関数（swSubscribe()）も呼び出す
+ * - 判定はすべてタイマーの割込みハンドラ内で行うため、キューは1対1で受け渡せる
+ *----------------------------------------------------------------------*/
+SPSC_DEFINE(swQueue, SwEvent_t, 8);
+
+static void (*swHandler)(const SwEvent_t *e) = 0;	// イベントを通知する関数
+static int swLongTimer = -1;		// 長押しのタイマー
+static int swDoubleTimer = -1;		// ダブルクリック判定のタイマー
+static unsigned char swLongCount;	// 長押しの経過回数
+static unsigned char swPending;		// 1: クリックの後、ダブルクリック判定中
+
+static void swEmit(unsigned char type, unsigned char n) {
+	SwEvent_t e;
+
+	e.type = type;
+	e.n    = n;
+	e.time = timerRead();
+
+	spscPut(&swQueue, &e);	// 満杯なら捨てる
+
+	if (swHandler) {
+		swHandler(&e);
+	}
+}
+
+static void swLong(void) {
+	// 2回目の押下が長押しになった: 1回目はクリックとして通知してから長押しとする
+	if (swPending) {
+		swPending = FALSE;
+		swEmit(SW_EVT_CLICK, 1);
+	}
+
+	if (swLongCount < 0xFF) {
+		swEmit(SW_EVT_LONG, ++swLongCount);
+	}
+}
+
+static void swDouble(void) {
+	swDoubleTimer = -1;
+	swPending = FALSE;
+	swEmit(SW_EVT_CLICK, 1);
+}
+
+static void swGesture(unsigned char state) {
+	// 押された
+	if (state == SW_ON) {
+		// ダブルクリック判定中: 判定は離したとき（または長押し）に行うため、満了させない
+		if (swDoubleTimer >= 0) {
+			timerStop(swDoubleTimer);
+			swDoubleTimer = -1;
+		}
+
+		swLongCount = 0;
+		swLongTimer = timerStart(SW_LONG_TIME, SW_LONG_TIME, swLong, TIMER_IN_ISR);
+		return;
+	}
+
+	// 離された
+	if (swLongTimer >= 0) {
+		timerStop(swLongTimer);
+		swLongTimer = -1;
+	}
+
+	if (swLongCount) {
+		// 長押しの後ではクリックとしない
+		swEmit(SW_EVT_HOLD, swLongCount);
+	}
+	else if (swPending) {
+		swPending = FALSE;
+		swEmit(SW_EVT_DOUBLE, 2);
+	}
+	else {
+		swPending = TRUE;
+		swDoubleTimer = timerStart(SW_DOUBLE_TIME, 0, swDouble, TIMER_IN_ISR);
+	}
+}
+
+/*----------------------------------------------------------------------
+ * スイッチ操作のイベントを受け取る関数を登録する（0: 解除）
+ * - 関数はタイマーの割込みハンドラから呼び出される
+ *----------------------------------------------------------------------*/
+void swSubscribe(void (*f)(const SwEvent_t *e)) {
+	swHandler = f;
+	swStart();
+}
+
+/*----------------------------------------------------------------------
+ * スイッチ操作のイベントを取り出す（戻り値 1: 取り出した、0: なし）
+ *----------------------------------------------------------------------*/
+int swGetEvent(SwEvent_t *e) {
+	swStart();
+	return spscGet(&swQueue, e) == 0;
 }
 
 #if	FALSE
@@ -299,72 +836,113 @@ int swClickHold(unsigned long msec) {
 
 	// 押されている間は待機
 	while (swScan() == SW_ON) {
-		if (timerRead() > t + msec) {
+		if (TIMER_AFTER(timerRead(), t + msec)) {
 			ledOff(LED1_LED2);
 		}
 	}
 
 	// 指定時間以上押されていたらHOLDを返す
-	return timerRead() > t + msec ? SW_HOLD : SW_ON;
+	return TIMER_AFTER(timerRead(), t + msec) ? SW_HOLD : SW_ON;
 }
 
+#endif // FALSE
+
 /*----------------------------------------------------------------------
- * 指定された整数値をLEDに出力する
+ * 指定された整数値をLEDとブザーで読み出す（待機しない）
+ * - 呼び出し時の値を保存し、LSBから2ビットずつLED1（上位）とLED2（下位）で表示する
+ * - 表示は LED_PRIO_SHOW の点灯パターンとして行い、走行中の表示より優先する
+ * - showNext() で次の2ビットに進み、先頭に戻るときは低い音で知らせる
+ * - USB（sciInit()）を使うと PIO0_3 と競合して LED1 が点灯しないため、
+ *   走行中のカウンタなどを通信なしで確認するのに使う
  *
  * - 使用例
- *	// スイッチを押すごとにLSBから2ビットずつLED1（上位）とLED2（下位）で値を表示する
- *	playInit();
- *	showValue(0xffff);
+ *	// クリックで次の2ビット、ダブルクリックで先頭、長押しで終了
+ *	showValue(counter);
+ *	swSubscribe(showEvent);
  *----------------------------------------------------------------------*/
 #include "play.h"
 
-#define	CLICK_HOLD_TIME	1000	// 長押し判定時間[sec]
+#define	SHOW_DIGITS		(sizeof(unsigned long) * 8 / 2)	// 2ビット単位の桁数
 
-void showValue(long val) {
-	int i, loop;
-	const MusicScore_t m[] = {{Do6, N16}, {Do5, N16}};
+static const LedStep_t showSteps[4][2] = {
+	{{LED_OFF,   850}, {LED_OFF, 150}},
+	{{LED2,      850}, {LED_OFF, 150}},
+	{{LED1,      850}, {LED_OFF, 150}},
+	{{LED1_LED2, 850}, {LED_OFF, 150}},
+};
 
-	while (swClick() == SW_OFF) {
-		ledFlush(100);
+static const LedPattern_t showPattern[4] = {
+	{showSteps[0], 2, 0},
+	{showSteps[1], 2, 0},
+	{showSteps[2], 2, 0},
+	{showSteps[3], 2, 0},
+};
+
+static volatile unsigned long showVal;	// 表示中の値（呼び出し時のスナップショット）
+static volatile int showDigit = -1;		// 表示中の桁（-1: 停止中）
+
+static void showUpdate(void) {
+	static const MusicScore_t m[] = {{Do6, N16}, {Do5, N16}};
+
+	// 演奏中は楽譜を上書きしないよう鳴らさない
+	if (!playIsPlaying()) {
+		playScore(showDigit ? &m[0] : &m[1], 1, 180, 0);
 	}
-	ledOff(LED1_LED2);
-	timerWait(500);
 
-	while (1) {
-		// スイッチを押すごとにLSBから2ビットずつLED1（上位）とLED2（下位）で値を表示する
-		for (i = 0; i < sizeof(val) * 8; i += 2) {
-			int v = (val >> i);
-			// LED1: 上位ビット、LED2: 下位ビット
-			ledOn((v & 0x02 ? LED1 : LED_OFF) | (v & 0x01 ? LED2: LED_OFF));
-			playScore(m, 1, 180, 0);
-			swStandby();
-			timerWait(100);
-		}
+	ledPlay(&showPattern[(showVal >> (showDigit * 2)) & 3], LED_PRIO_SHOW);
+}
 
-		// SW_OFF : スイッチが押されていなければLEDの点滅を繰り返す
-		// SW_ON  : 短くクリックされたらループを抜け値の表示を繰り返す
-		// SW_HOLD: 指定秒の長押し後、離されたら呼び出し元に戻る
-		for (loop = 1; loop == 1;) {
-			switch (swClickHold(CLICK_HOLD_TIME)) {
-			  case SW_OFF:
-				ledFlush(100);
-				break;
-			  case SW_ON:
-				ledOff(LED1_LED2);
-				timerWait(500);
-				loop = 0;
-				break;
-			  case SW_HOLD:
-			  default:
-				ledOff(LED1_LED2);
-				playScore(m, 2, 180, 0);
-				timerWait(1000);
-				return;
-			}
+void showValue(unsigned long val) {
+	showVal = val;
+	showDigit = 0;
+	showUpdate();
+}
+
+void showNext(void) {
+	if (showDigit >= 0) {
+		showDigit = (showDigit + 1) % SHOW_DIGITS;
+		showUpdate();
+	}
+}
+
+void showRewind(void) {
+	if (showDigit >= 0) {
+		showDigit = 0;
+		showUpdate();
+	}
+}
+
+void showStop(void) {
+	showDigit = -1;
+	ledCancel(LED_PRIO_SHOW);
+}
+
+int showActive(void) {
+	return showDigit >= 0;
+}
+
+/*----------------------------------------------------------------------
+ * スイッチ操作のイベントで読み出しを進める
+ * - クリック: 次の2ビット、ダブルクリック: 先頭に戻る、長押し: 終了
+ * - 長押しは最初の SW_EVT_LONG だけで判定し、押し続けても繰り返さない
+ *----------------------------------------------------------------------*/
+void showEvent(const SwEvent_t *e) {
+	switch (e->type) {
+	  case SW_EVT_CLICK:
+		showNext();
+		break;
+	  case SW_EVT_DOUBLE:
+		showRewind();
+		break;
+	  case SW_EVT_LONG:
+		if (e->n == 1) {
+			showStop();
 		}
+		break;
+	  default:
+		break;
 	}
 }
-#endif // FALSE
 
 #ifdef	EXAMPLE
 /*===============================================================================
@@ -374,13 +952,14 @@ void showValue(long val) {
 #include "type.h"
 #include "timer.h"
 #include "gpio.h"
+#include "atomic.h"
 
 /*----------------------------------------------------------------------
  * whileループを抜ける処理（割り込みハンドラから呼び出される想定）
  *----------------------------------------------------------------------*/
-volatile static char loopFlag = 1;
+static AtomicFlag_t loopFlag = 1;
 void exitLoop(void) {
-	loopFlag = 0;
+	atomicFlagClear(&loopFlag);
 	timerWaitCancel();
 }
 
@@ -399,7 +978,7 @@ void gpioExample(void) {
 	}
 
 	swWatch(exitLoop);		// 割込み処理関数を登録し、スイッチ状態を監視する
-	while (loopFlag) {		// スイッチの割り込みが検知されたらループを抜ける
+	while (atomicFlagTest(&loopFlag)) {	// スイッチの割り込みが検知されたらループを抜ける
 		ledFlush(500);		// LED1:500[msec] + LED2:500[msec]
 	}
 }
@@ -33,6 +33,7 @@ int main(void) {
 	 * - exampleType
 	 *	1: 直進性を確認し、駆動系のゲインを調整する
 	 *	2: 前進 --> 右旋回 --> 左旋回 --> 後退
+	 *	3: 不感帯を計測し、補正テーブルを作成する
 	 *-----------------------------------------*/
 	extern void pwmExample(int exampleType);
 	pwmExample(1);
@@ -67,6 +68,14 @@ int main(void) {
 	extern void pmuExample(int exampleType);
 	pmuExample(2);
 
+#elif	0
+	/*-----------------------------------------
+	 * ソフトウェアタイマーの動作確認
+	 * - 負荷をかけた状態で満了時刻からの遅れを計測する
+	 *-----------------------------------------*/
+	extern void timerExample(void);
+	timerExample();
+
 #elif	0
 	/*-----------------------------------------
 	 * バックグランド演奏の動作確認
@@ -75,6 +84,26 @@ int main(void) {
 	extern void playExample(void);
 	playExample();
 
+#elif	0
+	/*-----------------------------------------
+	 * プリエンプティブカーネルの動作確認
+	 * - exampleType
+	 *	1: コンテキスト切替時間の計測
+	 *	2: 制御スレッドの最悪起動遅延の計測
+	 *-----------------------------------------*/
+	extern void osExample(int exampleType);
+	osExample(2);
+
+#elif	0
+	/*-----------------------------------------
+	 * 不可分操作とリングバッファの動作確認
+	 * - exampleType
+	 *	1: 割込みハンドラとメイン処理による加算の競合
+	 *	2: リングバッファの受け渡し
+	 *-----------------------------------------*/
+	extern void atomicExample(int exampleType);
+	atomicExample(1);
+
 #else
 	/*-----------------------------------------
 	 * ライントレース
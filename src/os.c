@@ -0,0 +1,524 @@
+/*===============================================================================
+ * Name        : os.c
+ * Author      : $(author)
+ * Version     :
+ * CPU type    : ARM Cortex-M3 LPC1343
+ * Copyright   : $(copyright)
+ * Description : Fixed-priority preemptive kernel using PendSV and SysTick
+ *===============================================================================*/
+// Cortex Microcontroller Software Interface Standard
+#ifdef __USE_CMSIS
+#include "LPC13xx.h"
+#endif
+
+#include "type.h"
+#include "clk.h"
+#include "timer.h"
+#include "os.h"
+
+/*----------------------------------------------------------------------
+ * Kernel debug configuration
+ *----------------------------------------------------------------------*/
+#define	OS_DEBUG		0
+#if		OS_DEBUG
+#include <stdio.h>
+#include "sci.h"
+#else
+#define	sciPrintf(...)
+#endif
+
+/*----------------------------------------------------------------------
+ * スレッドの状態
+ *----------------------------------------------------------------------*/
+#define	OS_READY		0	// 実行可能
+#define	OS_DELAY		1	// osDelay() で待機中
+#define	OS_WAIT			2	// osWait() で待機中
+#define	OS_EXIT			3	// 終了
+
+/*----------------------------------------------------------------------
+ * スレッド管理テーブル
+ *----------------------------------------------------------------------*/
+typedef struct {
+	unsigned long *sp;		// 退避したスタックポインタ
+	unsigned long wake;		// 待機を終えるティック
+	unsigned char priority;	// 優先度（0が最優先）
+	unsigned char state;	// OS_READY ～ OS_EXIT
+	unsigned char signal;	// osSignal() の未処理回数
+} OsThread_t;
+
+static OsThread_t osThread[OS_THREAD_MAX + 1];	// 最後はアイドルスレッド
+static int osNum = 0;							// 登録済みのスレッド数
+static volatile int osCurrent = -1;				// 実行中のスレッド（-1: osStart() 前）
+static volatile unsigned long osTick = 0;		// SysTick のカウンタ
+
+/*----------------------------------------------------------------------
+ * SysTick のサービス
+ *----------------------------------------------------------------------*/
+static void (*tickHook)(void) = 0;		// 周期的に呼び出す関数
+static unsigned long tickPeriod = 0;	// 呼び出し周期[tick]
+static unsigned long tickCount  = 0;	// 呼び出しまでのカウンタ
+
+/*----------------------------------------------------------------------
+ * アイドルスレッド - 実行可能なスレッドがなければ WFI で割込みを待つ
+ *----------------------------------------------------------------------*/
+#define	OS_IDLE_STACK	64	// アイドルスレッドのスタック[word]
+OS_STACK(idleStack, OS_IDLE_STACK);
+
+static void idle(void) {
+	while (1) {
+		__WFI();
+	}
+}
+
+/*----------------------------------------------------------------------
+ * スレッドの関数から戻った場合の終了処理
+ *----------------------------------------------------------------------*/
+static void schedule(void);
+
+static void osExit(void) {
+	__disable_irq();
+	osThread[osCurrent].state = OS_EXIT;
+	schedule();
+	__enable_irq();
+
+	while (1);	// PendSV で切り替わる
+}
+
+/*----------------------------------------------------------------------
+ * 実行可能なスレッドのうち、最も優先度の高いスレッドを選ぶ
+ * - アイドルスレッドは常に実行可能
+ * - 同じ優先度なら実行中のスレッドを続け、osYield() 後は次のスレッドに回す
+ *----------------------------------------------------------------------*/
+static int osYielding = 0;	// 1: osYield() による切替要求
+
+static int pick(void) {
+	int i, id, found = OS_THREAD_MAX;
+	int start = (osCurrent >= 0 && osCurrent < osNum) ? osCurrent + 1 : 0;
+
+	for (i = 0; i < osNum; i++) {
+		id = (start + i) % osNum;
+		if (osThread[id].state == OS_READY && osThread[id].priority < osThread[found].priority) {
+			found = id;
+		}
+	}
+
+	if (!osYielding && osCurrent >= 0 && osThread[osCurrent].state == OS_READY &&
+		osThread[osCurrent].priority <= osThread[found].priority) {
+		found = osCurrent;
+	}
+
+	return found;
+}
+
+/*----------------------------------------------------------------------
+ * 実行すべきスレッドが変われば、PendSV で切り替える
+ * - 割込み禁止で呼び出すこと
+ *----------------------------------------------------------------------*/
+static void schedule(void) {
+	if (osCurrent >= 0 && pick() != osCurrent) {
+		// Interrupt Control and State Register (ICSR)
+		// Bit 28 (PENDSVSET): 1 = changes PendSV exception state to pending
+		SCB->ICSR = (1<<28);
+	}
+}
+
+/*----------------------------------------------------------------------
+ * コンテキストの切替 - PendSV_Handler() から割込み禁止で呼び出される
+ * - sp: 実行中のスレッドのスタック（0: osStart() からの最初の切替）
+ * - 戻り値は次に実行するスレッドのスタック
+ *----------------------------------------------------------------------*/
+unsigned long *osSwitchContext(unsigned long *sp) {
+	if (sp && osCurrent >= 0) {
+		osThread[osCurrent].sp = sp;
+	}
+
+	osCurrent = pick();
+	osYielding = 0;
+
+	return osThread[osCurrent].sp;
+}
+
+/*----------------------------------------------------------------------
+ * PendSV 割込みハンドラ - r4～r11 をスレッドのスタックに退避し、切り替える
+ * - r0～r3, r12, lr, pc, xPSR は例外の発生時にハードウェアが退避する
+ * - 最初の切替は MSP 上のメイン処理から行われるため、退避しない
+ *----------------------------------------------------------------------*/
+__attribute__((naked)) void PendSV_Handler(void) {
+	__asm volatile (
+		"	cpsid	i				\n"
+		"	mrs		r0, psp			\n"
+		"	tst		lr, #4			\n"	// EXC_RETURN Bit 2: 0 = MSP（最初の切替）
+		"	ite		eq				\n"
+		"	moveq	r0, #0			\n"
+		"	stmdbne	r0!, {r4-r11}	\n"
+		"	bl		osSwitchContext	\n"
+		"	ldmia	r0!, {r4-r11}	\n"
+		"	msr		psp, r0			\n"
+		"	ldr		lr, =0xFFFFFFFD	\n"	// Thread mode, PSP に復帰する
+		"	cpsie	i				\n"
+		"	bx		lr				\n"
+	);
+}
+
+/*----------------------------------------------------------------------
+ * SysTick 割込みハンドラ - 待機時間の経過したスレッドを起こし、サービスを呼び出す
+ *----------------------------------------------------------------------*/
+void SysTick_Handler(void) {
+	int id;
+
+	osTick++;
+
+	for (id = 0; id < osNum; id++) {
+		if (osThread[id].state == OS_DELAY && (long)(osTick - osThread[id].wake) >= 0) {
+			osThread[id].state = OS_READY;
+		}
+	}
+
+	// 周期的なサービス（ウォッチドッグの更新など）
+	if (tickHook && ++tickCount >= tickPeriod) {
+		tickCount = 0;
+		tickHook();
+	}
+
+	__disable_irq();
+	schedule();
+	__enable_irq();
+}
+
+/*----------------------------------------------------------------------
+ * SysTick の開始
+ *----------------------------------------------------------------------*/
+static void tickStart(void) {
+	// 17.6.1 System Timer Control and status register (CTRL)
+	// Bit 0 (ENABLE): 1 = the counter is enabled
+	if (!(SysTick->CTRL & (1<<0))) {
+		// SysTick_Config() is defined in  CMSIS_CORE_LPC13xx/inc/core_cm3.h
+		SysTick_Config(clkGetMainClock() / OS_TICK_HZ);
+	}
+}
+
+/*----------------------------------------------------------------------
+ * SysTick のサービスを登録する
+ * - カーネルの起動前にサービスを解除した場合は、SysTick も停止する
+ *----------------------------------------------------------------------*/
+void osTickHook(void (*f)(void), unsigned long msec) {
+	__disable_irq();
+	tickHook   = f;
+	tickPeriod = MAX(1, msec * OS_TICK_HZ / 1000);
+	tickCount  = 0;
+	__enable_irq();
+
+	if (f) {
+		tickStart();
+	}
+
+	// 17.6.1 System Timer Control and status register (CTRL)
+	// Bit 0 (ENABLE): 0 = the counter is disabled
+	// Bit 1 (TICKINT): 0 = the System Tick interrupt is disabled
+	// Bit 2 (CLKSOURCE): 1 = the system clock 0 (CPU) clock
+	else if (osCurrent < 0 && (SysTick->CTRL & (1<<0))) {
+		SysTick->CTRL &= (1<<2);
+	}
+}
+
+/*----------------------------------------------------------------------
+ * スレッドの登録
+ * - stack: OS_STACK() で定義したスタック領域、words: その大きさ[word]
+ * - 戻り値はスレッドの識別子（登録できない場合は -1）
+ *----------------------------------------------------------------------*/
+static int create(int id, void (*f)(void), unsigned long *stack, unsigned long words, int priority) {
+	unsigned long *sp;
+
+	// スタックの末尾から8バイト境界に揃えて積む
+	sp = (unsigned long *)((unsigned long)(stack + words) & ~7UL);
+
+	// 例外の発生時と同じ並びで、初期値を積む
+	*(--sp) = 0x01000000;				// xPSR (Thumb state)
+	*(--sp) = (unsigned long)f;			// PC
+	*(--sp) = (unsigned long)osExit;	// LR
+	sp -= 5;							// R12, R3, R2, R1, R0
+	sp -= 8;							// R11 ～ R4
+
+	osThread[id].sp       = sp;
+	osThread[id].priority = MAX(0, MIN(priority, OS_PRIO_IDLE));
+	osThread[id].state    = OS_READY;
+	osThread[id].signal   = 0;
+
+	return id;
+}
+
+int osThreadCreate(void (*f)(void), unsigned long *stack, unsigned long words, int priority) {
+	int id;
+
+	// スレッドの登録は osStart() の前に行う
+	if (!f || !stack || words < 32 || osCurrent >= 0 || osNum >= OS_THREAD_MAX) {
+		return -1;
+	}
+
+	// アイドルスレッドより優先させる
+	id = create(osNum, f, stack, words, MIN(priority, OS_PRIO_IDLE - 1));
+	osNum++;
+
+	return id;
+}
+
+/*----------------------------------------------------------------------
+ * カーネルの起動（戻らない）
+ *----------------------------------------------------------------------*/
+void osStart(void) {
+	create(OS_THREAD_MAX, idle, idleStack, OS_IDLE_STACK, OS_PRIO_IDLE);
+
+	// PendSV は最低の優先度とし、他の割込みの後で切り替える
+	NVIC_SetPriority(PendSV_IRQn, 0xFF);
+	tickStart();
+
+	// 最初の切替
+	SCB->ICSR = (1<<28);
+	__enable_irq();
+
+	while (1);	// PendSV で切り替わる
+}
+
+/*----------------------------------------------------------------------
+ * 同じ優先度のスレッドに実行を譲る
+ *----------------------------------------------------------------------*/
+void osYield(void) {
+	__disable_irq();
+	osYielding = 1;
+	if (pick() != osCurrent) {
+		SCB->ICSR = (1<<28);	// PENDSVSET
+	} else {
+		osYielding = 0;			// 譲る相手がいない
+	}
+	__enable_irq();
+}
+
+/*----------------------------------------------------------------------
+ * スレッドから呼び出されたか調べる
+ * - osStart() 前（osCurrent = -1）や割込みハンドラ内では FALSE
+ * Interrupt Control and State Register (ICSR)
+ * Bit 8:0 (VECTACTIVE): 0 = Thread mode
+ *----------------------------------------------------------------------*/
+static int inThread(void) {
+	return osCurrent >= 0 && (SCB->ICSR & 0x1FF) == 0;
+}
+
+/*----------------------------------------------------------------------
+ * 指定時間[msec]の待機
+ * - スレッド以外から呼び出された場合は timerWait() で待機する
+ *----------------------------------------------------------------------*/
+void osDelay(unsigned long msec) {
+	if (!inThread()) {
+		timerWait(msec);
+		return;
+	}
+
+	__disable_irq();
+	osThread[osCurrent].state = OS_DELAY;
+	osThread[osCurrent].wake  = osTick + MAX(1, msec * OS_TICK_HZ / 1000);
+	schedule();
+	__enable_irq();
+}
+
+/*----------------------------------------------------------------------
+ * osSignal() を待つ（既に通知されていればすぐに戻る）
+ * - スレッド以外から呼び出された場合は待たずに戻る
+ *----------------------------------------------------------------------*/
+void osWait(void) {
+	if (!inThread()) {
+		return;
+	}
+
+	__disable_irq();
+	while (!osThread[osCurrent].signal) {
+		osThread[osCurrent].state = OS_WAIT;
+		schedule();
+		__enable_irq();		// ここで PendSV により切り替わる
+		__disable_irq();
+	}
+	osThread[osCurrent].signal--;
+	__enable_irq();
+}
+
+/*----------------------------------------------------------------------
+ * スレッドへの通知（割込みハンドラからも呼び出せる）
+ * - 通知したスレッドの優先度が高ければ、すぐに切り替わる
+ *----------------------------------------------------------------------*/
+void osSignal(int id) {
+	unsigned long primask;
+
+	if (id < 0 || id >= osNum) {
+		return;
+	}
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+
+	if (osThread[id].signal < 0xFF) {
+		osThread[id].signal++;
+	}
+	if (osThread[id].state == OS_WAIT) {
+		osThread[id].state = OS_READY;
+	}
+	schedule();
+
+	__set_PRIMASK(primask);
+}
+
+/*----------------------------------------------------------------------
+ * 実行中のスレッド、SysTick のカウンタ
+ *----------------------------------------------------------------------*/
+int osSelf(void) {
+	return osCurrent;
+}
+
+unsigned long osTicks(void) {
+	return osTick;
+}
+
+#ifdef	EXAMPLE
+/*===============================================================================
+ * プリエンプティブカーネルの動作確認
+ *
+ * 【EXAMPLE1】コンテキスト切替時間の計測
+ *	低優先度のスレッドから高優先度のスレッドに osSignal() し、
+ *	高優先度のスレッドが実行を再開するまでのサイクル数を計測する
+ *
+ * 【EXAMPLE2】制御スレッドの最悪起動遅延の計測
+ *	1[msec]周期のタイマー割込みから最優先の制御スレッドを起こし、
+ *	SCI出力、ログ出力、LEDパターンを模擬した低優先度のスレッドが
+ *	動作している状態で、割込みから制御スレッドが実行されるまでの遅延を計測する
+ *
+ * - 計測結果が OS_LATENCY_LIMIT 以下なら LED1、超えたら LED2 を点灯する
+ *===============================================================================*/
+#include "type.h"
+#include "timer.h"
+#include "gpio.h"
+
+#define	OS_LATENCY_LIMIT	20	// 許容する遅延[μsec]
+
+static int threadHigh, threadLow;
+static volatile unsigned long stamp;		// 起動要求時のサイクル数
+static volatile unsigned long minCycles = 0xFFFFFFFF;
+static volatile unsigned long maxCycles = 0;
+
+OS_STACK(stack0, 128);
+OS_STACK(stack1, 128);
+OS_STACK(stack2, 128);
+OS_STACK(stack3, 128);
+
+/*----------------------------------------------------------------------
+ * 起動要求から実行再開までのサイクル数を記録する
+ *----------------------------------------------------------------------*/
+static void record(void) {
+	unsigned long c = timerCycles() - stamp;
+
+	minCycles = MIN(minCycles, c);
+	maxCycles = MAX(maxCycles, c);
+}
+
+/*----------------------------------------------------------------------
+ * 計測結果を表示する
+ *----------------------------------------------------------------------*/
+static void report(void) {
+	while (1) {
+		osDelay(1000);
+
+		ledOn(timerCyclesToMicros(maxCycles) <= OS_LATENCY_LIMIT ? LED1 : LED2);
+		sciPrintf("min = %ld, max = %ld [cycles]\r\n", minCycles, maxCycles);
+	}
+}
+
+/*----------------------------------------------------------------------
+ * 動作例1: コンテキスト切替時間の計測
+ *----------------------------------------------------------------------*/
+static void switchHigh(void) {
+	while (1) {
+		osWait();
+		record();
+	}
+}
+
+static void switchLow(void) {
+	while (1) {
+		stamp = timerCycles();
+		osSignal(threadHigh);	// ここで switchHigh() に切り替わる
+	}
+}
+
+static void osExample1(void) {
+	threadHigh = osThreadCreate(switchHigh, stack0, 128, 1);
+	threadLow  = osThreadCreate(switchLow,  stack1, 128, 3);
+	osThreadCreate(report, stack2, 128, 2);
+
+	osStart();
+}
+
+/*----------------------------------------------------------------------
+ * 動作例2: 制御スレッドの最悪起動遅延の計測
+ *----------------------------------------------------------------------*/
+static void controlTick(void) {
+	stamp = timerCycles();
+	osSignal(threadHigh);
+}
+
+static void control(void) {
+	while (1) {
+		osWait();
+		record();
+	}
+}
+
+static void sciOutput(void) {
+	while (1) {
+		timerDelayUs(10000);	// sciPrintf() の送信待ちを模擬する
+		osDelay(5);
+	}
+}
+
+static void ledPattern(void) {
+	while (1) {
+		timerDelayUs(50000);	// 割込み禁止を伴わない長い処理を模擬する
+		osYield();
+	}
+}
+
+static void osExample2(void) {
+	threadHigh = osThreadCreate(control,    stack0, 128, 0);
+	threadLow  = osThreadCreate(ledPattern, stack1, 128, 3);
+	osThreadCreate(report,    stack2, 128, 1);
+	osThreadCreate(sciOutput, stack3, 128, 2);
+
+	timerStart(1, 1, controlTick, TIMER_IN_ISR);
+
+	osStart();
+}
+
+/*----------------------------------------------------------------------
+ * プリエンプティブカーネルの動作例
+ * - exampleType
+ *	1: コンテキスト切替時間の計測
+ *	2: 制御スレッドの最悪起動遅延の計測
+ *----------------------------------------------------------------------*/
+void osExample(int exampleType) {
+	timerInit();	// timerCycles()
+	gpioInit();		// ledOn()
+	timerCycleInit();
+
+#if	OS_DEBUG
+	sciInit();		// PIO0_3がUSB_VBUSと競合するため、LED1（橙）点灯せず
+	swStandby();	// 通信の確立を確認し、SW1で動作を開始する
+#endif
+
+	switch (exampleType) {
+	  case 1:
+		osExample1();
+		break;
+
+	  case 2:
+	  default:
+		osExample2();
+		break;
+	}
+}
+#endif // EXAMPLE
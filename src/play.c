@@ -12,9 +12,89 @@
 #endif
 
 #include "type.h"
+#include "timer.h"
+#include "atomic.h"
 #include "play.h"
 #include "gpio.h"
 
+/*----------------------------------------------------------------------
+ * 楽譜データの読み出し位置
+ * - 非圧縮（MusicScore_t）と圧縮（PackedScore_t）のどちらか一方を読み出す
+ *----------------------------------------------------------------------*/
+typedef struct {
+	const MusicScore_t *score;		// 非圧縮の楽譜データ（playScore()）
+	const PackedScore_t *packed;	// 圧縮した楽譜データ（playPacked()）
+	int num;						// 残りの要素数
+	const PackedScore_t *repeat;	// 繰り返す区間の先頭
+	unsigned char repLen;			// 繰り返す区間の要素数
+	unsigned char repPos;			// 繰り返す区間内の位置
+	unsigned char repCount;			// 残りの繰り返し回数
+} PlayStream_t;
+
+static PlayStream_t stream;			// 再生中の位置
+
+/*----------------------------------------------------------------------
+ * 音階の番号（PI_Do2 ～ PI_Do7）に対する音階（pitch）
+ *----------------------------------------------------------------------*/
+static const unsigned short pitchTable[PLAY_PITCHES] = {
+	0,
+	Do2, Do2s, Re2, Re2s, Mi2, Fa2, Fa2s, So2, So2s, Ra2, Ra2s, Si2,
+	Do3, Do3s, Re3, Re3s, Mi3, Fa3, Fa3s, So3, So3s, Ra3, Ra3s, Si3,
+	Do4, Do4s, Re4, Re4s, Mi4, Fa4, Fa4s, So4, So4s, Ra4, Ra4s, Si4,
+	Do5, Do5s, Re5, Re5s, Mi5, Fa5, Fa5s, So5, So5s, Ra5, Ra5s, Si5,
+	Do6, Do6s, Re6, Re6s, Mi6, Fa6, Fa6s, So6, So6s, Ra6, Ra6s, Si6,
+	Do7,
+};
+
+/*----------------------------------------------------------------------
+ * 楽譜データから次の音符を読み出す（戻り値 TRUE: 読み出した、FALSE: 終わり）
+ * - 圧縮した楽譜データは1要素ずつ展開し、繰り返し（PR()）は直前の区間を読み直す
+ * - 割込みハンドラから呼び出されるため、展開用のバッファを持たない
+ *----------------------------------------------------------------------*/
+static int fetchNote(MusicScore_t *m) {
+	PlayStream_t *s = &stream;
+	const PackedScore_t *p = 0;
+
+	// 非圧縮
+	if (s->score) {
+		if (s->num <= 0) {
+			return FALSE;
+		}
+		*m = *s->score++;
+		s->num--;
+		return TRUE;
+	}
+
+	// 圧縮
+	if (!s->repCount) {
+		if (s->num <= 0) {
+			return FALSE;
+		}
+		p = s->packed++;
+		s->num--;
+
+		// 繰り返しの指定: 直前の repLen 個の要素を repCount 回読み直す
+		if (p->pitch == PLAY_PK_REPEAT) {
+			s->repLen   = (p->duration & 0x0F) + 1;
+			s->repCount = (p->duration >> 4) + 1;
+			s->repeat   = p - s->repLen;
+			s->repPos   = 0;
+		}
+	}
+
+	if (s->repCount) {
+		p = s->repeat + s->repPos;
+		if (++s->repPos >= s->repLen) {
+			s->repPos = 0;
+			s->repCount--;
+		}
+	}
+
+	m->pitch    = p->pitch < PLAY_PITCHES ? pitchTable[p->pitch] : 0;
+	m->duration = p->duration;
+	return TRUE;
+}
+
 #if	PLAY_MODE != PLAY_PWM_WRC103
 
 /*----------------------------------------------------------------------
@@ -22,24 +102,29 @@
  *----------------------------------------------------------------------*/
 #if	PLAY_MODE == PLAY_PWM_MODE
 static unsigned long playPitch = 0;
+static unsigned char playSound = 0;		// 0: 休符またはインターバル（無音）
+static long noteTicks = 0;				// 音符の残りカウント数
+#else
+static unsigned long playPeriod = 0;	// 出力を反転する間隔（半周期）のカウント数
+static unsigned long noteEnd = 0;		// 音符の終了時刻（TC）
 #endif
-static int countIRQ = 0;
-static int scoreNum = 0;
+static unsigned long unitTicks = 0;		// 16分音符のカウント数（演奏開始時に算出）
 static int baseTempo = 0;
-static const MusicScore_t* scorePtr = 0;
 
 /*----------------------------------------------------------------------
  * 割込みハンドラ用変数 - 繰り返し再生用変数
  *----------------------------------------------------------------------*/
 static int loopPlay = 0;
-static int loopNum  = 0;
-static const MusicScore_t* loopPtr = 0;
+static PlayStream_t loopStream;		// 楽譜データの先頭
+static unsigned char inInterval = FALSE;	// 繰り返し再生までのインターバル中
 
 /*----------------------------------------------------------------------
- * 割込みハンドラ用変数 - 休符フラグ
+ * ブザーの出力ピン（PIO1_8）
  *----------------------------------------------------------------------*/
-#if	PLAY_MODE == PLAY_TIMER_MODE
-static int playRest = 0;
+#define	PLAY_PIN	GPIO_PIN(LPC_GPIO1, 8)
+
+#if	PLAY_STAT
+static unsigned long statCycles = 0;	// 割込みハンドラの実行サイクル数の累計
 #endif
 
 /*----------------------------------------------------------------------
@@ -59,6 +144,13 @@ void playInit(void) {
 	/*-----------------------------------------
 	 * Timer Configuration
 	 *-----------------------------------------*/
+	// MR3: 音の周期、MR1: 音符の境界（PLAY_TIMER_MODE）、MR2: PWM出力（PLAY_PWM_MODE）
+#if	PLAY_MODE == PLAY_TIMER_MODE
+	timerClaim(TMR_32B0, TMR_COUNTER | TMR_MR1 | TMR_MR3, "play");
+#else
+	timerClaim(TMR_32B0, TMR_COUNTER | TMR_MR2 | TMR_MR3, "play");
+#endif
+
 	// 3.5.18 System AHB clock control register (SYSAHBCLKCTRL)
 	// Bit 9 (CT32B0): Enables clock for 32-bit counter/timer 0
 	// Note: LPC_SYSCON->SYSAHBCLKDIV = 1 --> PCLK = 72MHz
@@ -87,9 +179,10 @@ void playInit(void) {
 #if	PLAY_MODE == PLAY_TIMER_MODE
 
 	// 16.8.6 Match Control Register (TMR32B0MCR)
-	// Bit 9 (MR3I): Enable interrupt when MR3 matches TC
-	// Bit10 (MR3R): Reset TC when MR3 matches TC
-	LPC_TMR32B0->MCR = (1<<10|1<<9);
+	// Bit 3 (MR1I): Enable interrupt when MR1 matches TC（音符の境界）
+	// Bit 9 (MR3I): Enable interrupt when MR3 matches TC（出力の反転、休符では禁止）
+	// TC はリセットせずに進め、MR1、MR3 に次の時刻を加算して設定する
+	LPC_TMR32B0->MCR = (1<<9|1<<3);
 
 #else // PLAY_MODE == PLAY_PWM_MODE
 
@@ -114,122 +207,136 @@ void playInit(void) {
 }
 
 /*----------------------------------------------------------------------
- * 音符長のための割込み回数を算出する
+ * 音符長のカウント数
+ *
+ *    PCLK（デフォルト72MHz）を PLAY_PRE_SCALE で分周したカウント（TC）の
+ *    周波数は f = PCLK ÷ PRE_SCALE [Hz] となる。
+ *
+ *    4分音符の1分間の拍数を B（tempo）とすると、16分音符の再生時間は
+ *    60 ÷ (4 × B) [sec] であり、n 倍の音符長（N16 = 1, N8 = 2, ...）の
+ *    再生時間をカウント数で表すと以下となる。
+ *
+ *      L = f × 60 ÷ (4 × B) × n = (f × 15 ÷ B) × n
+ *
+ *    f × 15 ÷ B（unitTicks）は演奏開始時にテンポごとに1回だけ算出し、
+ *    音符の切り替えに除算を使わない（乗算と代入のみ）。
+ *
+ *    PLAY_TIMER_MODE: TC を止めずに進め、MR1 に音符の終了時刻（noteEnd += L）を、
+ *      MR3 に次に出力を反転する時刻（MR3 += pitch × PLAY_PIT_SCALE）を設定する。
+ *      音符長は音符ごとに1回の MR1 割込みで数え、半周期ごとの MR3 割込みは
+ *      出力の反転だけを行う。
+ *    PLAY_PWM_MODE: MR3 の一致（PLAY_PWM_CYCLE）ごとに L から差し引く。
+ *----------------------------------------------------------------------*/
+#define	PLAY_TICK_HZ		(PLAY_PCLK / PLAY_PRE_SCALE)	// TC のカウント周波数[Hz]
+#define	PLAY_TICKS_PER_MSEC	(PLAY_TICK_HZ / 1000)			// 1[msec]当たりのカウント数
+
+/*----------------------------------------------------------------------
+ * 音符をマッチレジスタに設定する
  *----------------------------------------------------------------------*/
-static int calcInterval(const MusicScore_t *score) {
+static void setNote(const MusicScore_t *m) {
 #if	PLAY_MODE == PLAY_TIMER_MODE
 
-	/*-------------------------------------------------------------------
-	 * 音符長に応じたマッチレジスタ（MR3）による割り込み回数の設定方法
-	 *
-	 * 再生する音階の周波数により、マッチレジスタの値が異なるため、
-	 * 音階ごとに1音符あたりの再生時間を調整する必要がある。そこで
-	 * 各音符長に応じた割り込みの発生回数（countIRQ）を算出する。
-	 *
-	 * 【1. 各音階の再生に必要なマッチレジスタの値を算出する】
-	 *    PCLK（デフォルト72MHz）をPLAY_PRE_SCALEで分周すると
-	 *    1カウントあたりの周波数f[Hz]と周期t[sec]は以下となる。
-	 *
-	 *      f = PCLK ÷ PRE_SCALE
-	 *      t = 1/f = PRE_SCALE ÷ PCLK
-	 *
-	 *    ∴再生する音階の周波数F[Hz]に必要なマッチレジスタ（MR3）
-	 *    の値pは以下となる。
-	 *
-	 *      p = 1/F ÷ t = PCLK ÷ (PRE_SCALE × F)
-	 *
-	 * 【2. 音符長から再生時間を算出する】
-	 *    4分音符の1分間の拍数B(BASE_DURATION)を基準に、16分音符の
-	 *    再生時間をT[sec]としたときの、N分音符と再生時間の関係は以下の通り。
-	 *
-	 *    N 分音符  16分音符  8分音符  4分音符  2分音符  全音符
-	 *    拍数／分   B×4      B×2     B×1     B÷2     B÷4
-	 *    再生時間   T×1      T×2     T×4     T×8     T×16
-	 *    倍数 n     1        2       4       8       16
-	 *
-	 *    即ち、各音符長の再生時間Lは以下となる。
-	 *
-	 *      L = 60 ÷ (4 × BASE_DURATION) × N
-	 *
-	 *    また、1回のマッチに要する時間Sは
-	 *
-	 *      S = PRE_SCALE × p ÷ PCLK
-	 *
-	 *    となるため、MR3による割り込み発生回数Iは以下で表される。
-	 *
-	 *      I = L ÷ S
-	 *        = 60 ÷ (4 × BASE_DURATION) × n ÷ (PRE_SCALE × p ÷ PCLK)
-	 *        = 60 ÷ (4 × BASE_DURATION) × (PCLK ÷ PRE_SCALE ÷ p) × n
-	 *
-	 * 注1： PRE_SCALE は、ON-OFFの2回で1周期となるため、2倍する
-	 * 注2： BASE_DURATION は同様の理由により、1/2とする
-	 *-------------------------------------------------------------------*/
-	int p = score->pitch ? score->pitch : Do4; // 休符の場合は代替の音階を設定
-
-	// 整数演算によるオーバーフローを避けるため、除算を先に行う
-	return (PLAY_PCLK / (2 * PLAY_PRE_SCALE * PLAY_PIT_SCALE * p)) * 60 / (2 * baseTempo) * score->duration;
-
-#else // PLAY_MODE != PLAY_TIMER_MODE
-
-	// PWMモードの場合は、ピッチによらずサイクルは一定
-	return (PLAY_PCLK / (2 * PLAY_PRE_SCALE * PLAY_PWM_CYCLE    )) * 60 / (2 * baseTempo) * score->duration;
+	// 16.8.7 Match register (TMR32B0MRn)
+	noteEnd += unitTicks * m->duration;
+	LPC_TMR32B0->MR1 = noteEnd;
+
+	if (m->pitch > 0) {
+		playPeriod = m->pitch * PLAY_PIT_SCALE;
+		LPC_TMR32B0->MR3 = LPC_TMR32B0->TC + playPeriod;
+		timerMatchControl(TMR_32B0, 3, TMR_MCR_I);
+	} else {
+		// 休符の場合は反転を止めて無音にする
+		timerMatchControl(TMR_32B0, 3, 0);
+		gpioPinWrite(PLAY_PIN, 0);
+	}
+
+#else // PLAY_MODE == PLAY_PWM_MODE
+
+	noteTicks = unitTicks * m->duration;
+	playSound = (m->pitch > 0);
+
+	// 16.8.7 Match register (TMR32B0MRn)
+	playPitch = m->pitch * PLAY_PIT_SCALE - 1;
+
+	LPC_TMR32B0->MR2 += playPitch;// Add match counter to initial value
 
 #endif // PLAY_MODE
 }
 
 /*----------------------------------------------------------------------
- * 楽譜の演奏
- * score: 楽譜データへのポインタ
- * num  : 楽譜データ中の音符数
- * tempo: 演奏する速さ（1分間に入る四分音符の数、メトロノーム記号）
- * loop : 0 = 繰り返し再生なし、0以外: loop[msec]後に再生を繰り返す
+ * タイマーを起動する
  *----------------------------------------------------------------------*/
-void playScore(const MusicScore_t *score, int num, int tempo, int loop) {
-	unsigned long pitch;
+static void playStart(void) {
+	// 6.6.2 Interrupt Set-Enable Register 1
+	// Bit 11 (ISE_CT32B0): Enable timer CT32B0 interrupt
+	// Note: NVIC = Nested Vectored Interrupt Controller
+	NVIC_EnableIRQ(TIMER_32_0_IRQn);
+
+	// 16.8.2 Timer Control Register (TMR32B0TCR)
+	LPC_TMR32B0->TCR = 1; // Bit0(CEN) : TC and PC are enabled for counting
+}
+
+/*----------------------------------------------------------------------
+ * 楽譜データの演奏を開始する
+ *----------------------------------------------------------------------*/
+static void playBegin(const PlayStream_t *st, int tempo, int loop) {
+	MusicScore_t m;
+	int ok;
+
+	// 演奏中にメイン処理から呼び出された場合、割込みハンドラが更新途中の設定を
+	// 参照しないよう、CT32B0 の割込みだけを禁止する（他の割込みは遅らせない）
+	CritState_t s = critEnterIRQ(TIMER_32_0_IRQn);
 
 	// バックグラウンド再生の設定
-	scoreNum = num;
-	scorePtr = score;
+	stream = loopStream = *st;
+	inInterval = FALSE;
 	baseTempo = tempo ? tempo : PLAY_BASE_TEMPO;
-	countIRQ = calcInterval(score);
+	unitTicks = PLAY_TICK_HZ * 15 / baseTempo;
 
 	// 繰り返し再生の設定
 	loopPlay = loop; // [msec]
-	if (loopPtr == 0) {
-		loopPtr = score;
-		loopNum = num;
-	}
+
+	// 16.8.2 Timer Control Register (TMR32B0TCR)
+	// Bit1(CRES): TC and PC are reset（playStart() まで停止する）
+	LPC_TMR32B0->TCR = 2;
 
 #if	PLAY_MODE == PLAY_TIMER_MODE
+	noteEnd = 0;
+#endif
 
-	if (score->pitch > 0) {
-		pitch = score->pitch * PLAY_PIT_SCALE - 1;
-		playRest = 0;
-	} else {
-		pitch = Do4 * PLAY_PIT_SCALE - 1;
-		playRest = 1; // 休符の場合
+	if ((ok = fetchNote(&m)) != FALSE) {
+		setNote(&m);
 	}
 
-	// 16.8.7 Match register (TMR32B0MRn)
-	LPC_TMR32B0->MR3 = pitch;
+	critExitIRQ(TIMER_32_0_IRQn, s);
 
-#else // PLAY_MODE == PLAY_PWM_MODE
-
-	// 16.8.7 Match register (TMR32B0MRn)
-	playPitch = pitch = score->pitch * PLAY_PIT_SCALE - 1;
+	if (ok) {
+		playStart();
+	} else {
+		playStop();
+	}
+}
 
-	LPC_TMR32B0->MR2 += pitch;// Add match counter to initial value
+/*----------------------------------------------------------------------
+ * 楽譜の演奏
+ * score: 楽譜データへのポインタ
+ * num  : 楽譜データ中の音符数
+ * tempo: 演奏する速さ（1分間に入る四分音符の数、メトロノーム記号）
+ * loop : 0 = 繰り返し再生なし、0以外: loop[msec]後に再生を繰り返す
+ *----------------------------------------------------------------------*/
+void playScore(const MusicScore_t *score, int num, int tempo, int loop) {
+	PlayStream_t st = {score, 0, num, 0, 0, 0, 0};
 
-#endif // PLAY_MODE
+	playBegin(&st, tempo, loop);
+}
 
-	// 6.6.2 Interrupt Set-Enable Register 1
-	// Bit 11 (ISE_CT32B0): Enable timer CT32B0 interrupt
-	// Note: NVIC = Nested Vectored Interrupt Controller
-	NVIC_EnableIRQ(TIMER_32_0_IRQn);
+/*----------------------------------------------------------------------
+ * 圧縮した楽譜の演奏（引数は playScore() と同じ、num は PS()、PR() の要素数）
+ *----------------------------------------------------------------------*/
+void playPacked(const PackedScore_t *score, int num, int tempo, int loop) {
+	PlayStream_t st = {0, score, num, 0, 0, 0, 0};
 
-	// 16.8.2 Timer Control Register (TMR32B0TCR)
-	LPC_TMR32B0->TCR = 2; // Bit1(CRES): TC and PC are synchronously reset on next PCLK positive edge
-	LPC_TMR32B0->TCR = 1; // Bit0(CEN) : TC and PC are enabled for counting
+	playBegin(&st, tempo, loop);
 }
 
 /*----------------------------------------------------------------------
@@ -265,34 +372,58 @@ int playIsPlaying(void) {
 }
 
 /*----------------------------------------------------------------------
- * 指定時間[msec]分のインターバルをとる
+ * 音符を最後まで再生した後の処理（割込みハンドラから呼び出される）
+ * - 楽譜データを最後まで再生した後に、指定時間（loop[msec]）後に再生を再開する
+ * - 戻り値 TRUE: 再生を続ける、FALSE: 再生を終えた
  *----------------------------------------------------------------------*/
-static void playInterval(int msec) {
-	const MusicScore_t interval = {Do5, N0};
+static int nextNote(void) {
+	MusicScore_t m;
 
-	scorePtr = 0;
-	countIRQ = calcInterval(&interval) * msec * baseTempo / (1000 * 90);
+	if (!inInterval && fetchNote(&m)) {
+		// 楽譜データを次に進める
+		setNote(&m);
+	}
+	else if (!inInterval && loopPlay > 0) {
+		// 指定時間（loopPlay[msec]）だけインターバルをとる
+		inInterval = TRUE;
 
 #if	PLAY_MODE == PLAY_TIMER_MODE
-	playRest = 1;
+		noteEnd += (unsigned long)loopPlay * PLAY_TICKS_PER_MSEC;
+		LPC_TMR32B0->MR1 = noteEnd;
+		timerMatchControl(TMR_32B0, 3, 0);
+		gpioPinWrite(PLAY_PIN, 0);
+#else
+		noteTicks = (long)loopPlay * PLAY_TICKS_PER_MSEC;
+		playSound = 0;
 #endif
+	}
+	else if (loopPlay) {
+		// インターバル後（loop < 0 の場合は直ちに）元データを設定し、再生を再開する
+		inInterval = FALSE;
+		stream = loopStream;
+		if (!fetchNote(&m)) {
+			playStop();
+			return FALSE;
+		}
+		setNote(&m);
+	}
+	else {
+		// 再生終了
+		playStop();
+		return FALSE;
+	}
 
-	// 6.6.2 Interrupt Set-Enable Register 1
-	// Bit 11 (ISE_CT32B0): Enable timer CT32B0 interrupt
-	// Note: NVIC = Nested Vectored Interrupt Controller
-	NVIC_EnableIRQ(TIMER_32_0_IRQn);
-
-	// 16.8.2 Timer Control Register (TMR32B0TCR)
-	LPC_TMR32B0->TCR = 2; // Bit 1 (CRES): TC and PC are synchronously reset on next PCLK positive edge
-	LPC_TMR32B0->TCR = 1; // Bit 0 (CEN) : TC and PC are enabled for counting
+	return TRUE;
 }
 
 /*----------------------------------------------------------------------
  * マッチレジスタによる割込みハンドラ
  *----------------------------------------------------------------------*/
 void TIMER32_0_IRQHandler(void) {
-	static unsigned long toggle = 0;
 	unsigned long IR = LPC_TMR32B0->IR;
+#if	PLAY_STAT
+	unsigned long entry = timerCycles();
+#endif
 
 	// 16.8.1 Interrupt Register (TMR32B0IR)
 	// Reset the interrupt flag for MR0INT～MR3INT
@@ -300,50 +431,52 @@ void TIMER32_0_IRQHandler(void) {
 	//       Writing '0' has no effect
 	LPC_TMR32B0->IR = IR; // Required
 
-	// バックグラウンド再生のシーケンス制御
-	// 規定回数（countIRQ）分のPWMサイクル実行後に再生を停止し、楽譜データを進める
-	// 楽譜データを最後まで再生した後に、指定時間（loop[msec]）後に再生を再開する
-	if (IR & (1 << 3) && --countIRQ <= 0) {
-		playStop();
+#if	PLAY_MODE == PLAY_TIMER_MODE
 
-		if (scorePtr) {
-			if (--scoreNum > 0) {
-				// 楽譜データを次に進める
-				playScore(scorePtr + 1, scoreNum, baseTempo, loopPlay);
-			} else if (loopPlay) {
-				// 指定時間（loopPlay[msec]）だけインターバルをとる
-				playInterval(loopPlay);
-			} else {
-				// 再生終了の場合は、繰り返し再生用の楽譜を初期化する
-				loopPtr = 0;
-			}
-		} else {
-			// インターバル後（scorePtr=0 かつ countIRQ=0）に元データを設定し、再生を再開する
-			playScore(loopPtr, loopNum, baseTempo, loopPlay);
+	// Bit 3 (MR3INT): 半周期ごとに出力を反転し、次の反転時刻を設定する
+	if (IR & (1 << 3)) {
+		static unsigned long toggle = 0;
+
+		gpioPinWrite(PLAY_PIN, toggle ^= GPIO_MASK(8));
+		LPC_TMR32B0->MR3 += playPeriod;
+
+		// 割込みの遅れで反転時刻を過ぎた場合は、TC の一周を待たずに設定し直す
+		if ((long)(LPC_TMR32B0->MR3 - LPC_TMR32B0->TC) <= 0) {
+			LPC_TMR32B0->MR3 = LPC_TMR32B0->TC + playPeriod;
 		}
 	}
 
-#if	PLAY_MODE == PLAY_TIMER_MODE
-
-	// Toggle output
-	else {
-		// playRest=1の場合は無音にする
-		gpioSetBit(LPC_GPIO1, 8, (playRest ? (toggle = 0) : (toggle = !toggle)));
+	// Bit 1 (MR1INT): 音符の境界
+	if (IR & (1 << 1)) {
+		nextNote();
 	}
 
 #else // PLAY_MODE == PLAY_PWM_MODE
 
+	static unsigned long toggle = 0;
+
+	// バックグラウンド再生のシーケンス制御
+	// 音符長のカウント数（noteTicks）を MR3 の一致ごとに減らし、尽きたら楽譜データを進める
+	if (IR & (1 << 3) && (noteTicks -= PLAY_PWM_CYCLE) <= 0) {
+		// MR2、MR3 を初期値に戻してから次の音符を設定し、TC をリセットして再開する
+		playStop();
+		if (nextNote()) {
+			LPC_TMR32B0->TCR = 2;
+			playStart();
+		}
+	}
+
 	// PWM出力
-	// scorePtr=0 または scorePtr->pitch=0 の場合は無音となる
+	// 休符またはインターバル（playSound=0）の場合は無音となる
 	else if (LPC_TMR32B0->MR2 < LPC_TMR32B0->MR3) {
-		if (scorePtr && scorePtr->pitch) {
+		if (playSound) {
 			gpioSetBit(LPC_GPIO1, 8, (toggle = !toggle));
 			LPC_TMR32B0->MR2 += playPitch;
 		}
 	}
 
 	else if (LPC_TMR32B0->MR2 == LPC_TMR32B0->MR3) {
-		if (scorePtr && scorePtr->pitch) {
+		if (playSound) {
 			gpioSetBit(LPC_GPIO1, 8, (toggle = !toggle));
 			LPC_TMR32B0->MR2 = playPitch;
 		}
@@ -354,8 +487,33 @@ void TIMER32_0_IRQHandler(void) {
 	}
 
 #endif // PLAY_MODE
+
+#if	PLAY_STAT
+	statCycles += timerCycles() - entry;
+#endif
 }
 
+/*----------------------------------------------------------------------
+ * 割込みハンドラの負荷（前回の呼び出しからの実行時間の割合[1/1000]）
+ *----------------------------------------------------------------------*/
+#if	PLAY_STAT
+unsigned long playLoad(void) {
+	static unsigned long lastCycles = 0, lastTime = 0;
+	unsigned long now = timerCycles();
+	unsigned long busy, elapsed;
+	CritState_t s = critEnterIRQ(TIMER_32_0_IRQn);
+
+	busy = statCycles - lastCycles;
+	lastCycles = statCycles;
+	critExitIRQ(TIMER_32_0_IRQn, s);
+
+	elapsed = now - lastTime;
+	lastTime = now;
+
+	return elapsed ? (unsigned long)((unsigned long long)busy * 1000 / elapsed) : 0;
+}
+#endif // PLAY_STAT
+
 #else // PLAY_MODE == PLAY_PWM_WRC103
 
 /*======================================================================
@@ -456,30 +614,51 @@ void playInit(void) {
 	LPC_IOCON->PIO1_8 = 0;
 	LPC_SYSCON->SYSAHBCLKCTRL |= (1 << 9);
 
+	timerClaim(TMR_32B0, TMR_COUNTER | TMR_MR2 | TMR_MR3, "play");
 	Timer32Init();
 }
 
 /*----------------------------------------------------------------------
- * 楽譜の演奏
- * score: 楽譜データへのポインタ
- * num  : 楽譜データ中の音符数
- * loop : 0: 繰り返し再生なし、0以外: loop[msec]後に再生を繰り返す
+ * 楽譜データの演奏（フォアグラウンド）
  *----------------------------------------------------------------------*/
-void playScore(const MusicScore_t *score, int num, int tempo, int loop) {
+static void playBegin(const PlayStream_t *st, int tempo, int loop) {
+	MusicScore_t m;
+
 	do {
-		int i;
-		for (i = 0; i < num; i++) {
-			if (score[i].pitch) {
-				BuzzerSet(score[i].pitch, 128);
+		stream = *st;
+		while (fetchNote(&m)) {
+			if (m.pitch) {
+				BuzzerSet(m.pitch, 128);
 				BuzzerStart();
 			}
-			timerWait((PLAY_PCLK / (2 * PLAY_PRE_SCALE * PLAY_PWM_CYCLE)) * 60 / (2 * tempo + 35) * score[i].duration);
+			timerWait((PLAY_PCLK / (2 * PLAY_PRE_SCALE * PLAY_PWM_CYCLE)) * 60 / (2 * tempo + 35) * m.duration);
 			BuzzerStop();
 		}
 		timerWait(loop);
 	} while (loop);
 }
 
+/*----------------------------------------------------------------------
+ * 楽譜の演奏
+ * score: 楽譜データへのポインタ
+ * num  : 楽譜データ中の音符数
+ * loop : 0: 繰り返し再生なし、0以外: loop[msec]後に再生を繰り返す
+ *----------------------------------------------------------------------*/
+void playScore(const MusicScore_t *score, int num, int tempo, int loop) {
+	PlayStream_t st = {score, 0, num, 0, 0, 0, 0};
+
+	playBegin(&st, tempo, loop);
+}
+
+/*----------------------------------------------------------------------
+ * 圧縮した楽譜の演奏（引数は playScore() と同じ、num は PS()、PR() の要素数）
+ *----------------------------------------------------------------------*/
+void playPacked(const PackedScore_t *score, int num, int tempo, int loop) {
+	PlayStream_t st = {0, score, num, 0, 0, 0, 0};
+
+	playBegin(&st, tempo, loop);
+}
+
 /*----------------------------------------------------------------------
  * 演奏を停止する
  *----------------------------------------------------------------------*/
@@ -503,27 +682,23 @@ int playIsPlaying(void) {
  * - フォアグラウンド演奏としたい場合は、以下の様に playIsPlaying() でブロックする
  *	playScore(...);
  *	while (playIsPlaying());
+ * - 圧縮した楽譜データ（*_pk.dat）は tools/dat2pk.py で *.dat から生成する
  *===============================================================================*/
 #include "timer.h"
 #include "gpio.h"
 #include "play.h"
+#include "score.h"
 
 /*----------------------------------------------------------------------
  * バックグラウンド演奏の動作例
  *----------------------------------------------------------------------*/
 void playExample(void) {
-	const MusicScore_t ms[] = {
-//#include "doremi.dat"	// tempo = PLAY_BASE_TEMPO
-//#include "lupin.dat"	// tempo = 132
-#include "truth.dat"	// tempo = 155
-	};
-
 	timerInit();	// timerWait()
 	gpioInit();		// ledOn()
 	playInit();
 
 	// バックグラウンドで演奏
-	playScore(ms, sizeof(ms) / sizeof(MusicScore_t), 155, -1);
+	scorePlay(SCORE_TRUTH, 0, -1);	// SCORE_DOREMI, SCORE_LUPIN
 
 	// フォアグラウンドでLチカ
 	while (1) {
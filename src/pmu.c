@@ -296,12 +296,13 @@ unsigned int pmuSleep(int mode) {
 		break;
 
 	  case PMU_DEEP_SLEEP:
+		deepSleepMode();
 #if	(INTERRUPT_FROM == INTERNAL_TIMER)
+		// メインクロックを切り替えた後のカウント数で設定する
 		if (pwmInterval) {
 			timerWakeup(pwmInterval, WAKEUP_IRQHandler);
 		}
 #endif
-		deepSleepMode();
 		break;
 
 	  case PMU_POWER_DOWN:
@@ -322,7 +323,7 @@ unsigned int pmuSleep(int mode) {
  * - Active/Sleep/Deep-sleep/Deep Power-down 各モードの動作例
  *
  * 【EXAMPLE1】
- *	timerWakeup() によるタイマー割り込みにより一定周期でタスクを起動する
+ *	timerStart() による周期的なタイマー割り込みによりタスクを起動する
  *
  * 【EXAMPLE2】
  *	内部割込み（タイマー割込み）、または外部割込み（スイッチによる割込み）でタスクを起動する
@@ -331,7 +332,7 @@ unsigned int pmuSleep(int mode) {
  *
  *	・INTERRUPT_FROM = EXTERNAL_SWITCH （1, 外部割込み）の場合
  *	  スイッチによる割り込みでタスクを起動する
- *	  ・Active/Sleep mode では、swWatch() により1回だけ起動する
+ *	  ・Active/Sleep mode では、swWatch() によりスイッチのエッジごとに起動する
  *	  ・Deep-sleep mode では、直接 start logic で外部トリガ（スイッチ）を監視しているため、
  *	    スイッチを押すたびにタスクが起動される
  *===============================================================================*/
@@ -347,15 +348,14 @@ unsigned int pmuSleep(int mode) {
  *----------------------------------------------------------------------*/
 static void wakeupHandler(void) {
 	sciPrintf("wakeupHandler\r\n");
-
-	timerWakeup(1000, wakeupHandler); // 1秒周期でタイマー割り込み発生させる
 }
 
 /*----------------------------------------------------------------------
  * 動作例1: Active mode　でのスリープ
  *----------------------------------------------------------------------*/
 static void pmuExample1() {
-	timerWakeup(1, wakeupHandler);	// 1[msec]後にタイマー割り込み発生させる
+	// 1[msec]後から1秒周期でタイマー割り込み発生させる
+	timerStart(1, 1000, wakeupHandler, TIMER_IN_ISR);
 
 	while (1) {
 		__WFI();					// Wait For Interrupt
@@ -396,7 +396,7 @@ static void pmuExample2() {
  *	2: Sleep/Deep-sleep/Deep Power-down
  *----------------------------------------------------------------------*/
 void pmuExample(int exampleType) {
-	const MusicScore_t m[] = {{Fa6, N16}, {Fa5, N16}};
+	static const MusicScore_t m[] = {{Fa6, N16}, {Fa5, N16}};
 
 	timerInit();	// timerWakeup()
 	gpioInit();		// ledBlink()
@@ -12,9 +12,17 @@
 #endif
 
 #include "type.h"
+#include "clk.h"
 #include "gpio.h"
+#include "adc.h"
+#include "timer.h"
 #include "pwm.h"
 
+/*----------------------------------------------------------------------
+ * 回転方向の出力ポート（PIO2_0 ～ PIO2_3）
+ *----------------------------------------------------------------------*/
+#define	PWM_PINS_DIR	GPIO_PINS_OF(LPC_GPIO2, 0x000F)
+
 /*----------------------------------------------------------------------
  * 左右駆動系のバラツキを補正する係数[%]
  *----------------------------------------------------------------------*/
@@ -23,14 +31,248 @@
 #define	PWM_GAIN_R		98		// 右駆動系の補正係数
 
 /*----------------------------------------------------------------------
- * 停止時の出力 （FALSE:フリー、TRUE：回生ブレーキ）
+ * 電源電圧によるフィードフォワード補正
+ * 電池電圧が下がると同じデューティでも速度が落ちるため、基準電圧との比で
+ * デューティを補正し、実効的な駆動電圧をゲイン調整時と同じに保つ
+ *----------------------------------------------------------------------*/
+#define	PWM_VBAT_NOMINAL	3000	// 基準電圧[mV]（ゲイン調整時の電池電圧）
+#define	PWM_VBAT_SHIFT		12		// 補正係数の小数部のビット数
+#define	PWM_VBAT_FILTER		4		// 電圧のローパスフィルタ（1/16）
+#define	PWM_VBAT_MIN(nom)	((nom) / 2)	// 妥当な電源電圧の下限（補正係数 2.0 倍に相当）
+
+static unsigned char vbatEnable = FALSE;				// TRUE: 電源電圧で補正する
+static unsigned short vbatNominal = PWM_VBAT_NOMINAL;	// 基準電圧[mV]
+static volatile unsigned long vbatFilter = 0;			// 電源電圧[mV] × 2^PWM_VBAT_FILTER
+static volatile unsigned long vbatScale = (1 << PWM_VBAT_SHIFT);	// 補正係数
+
+/*----------------------------------------------------------------------
+ * 停止時の出力モード（PWM_BRAKE_COAST：フリー、PWM_BRAKE_SHORT：短絡ブレーキ）
  *
- * 回転方向の出力ポート（PIO0_8, PIO0_9）を両方とも 'H' とすれば、
- * 原理上は回生ブレーキとなるが、効果は観測されず、また停止し続けた
- * 場合は僅かながら電力を消費することになるため、FALSE とする。
- * ただし TRUE とすることで実験可能なコードは残しておくこととする。
+ * 回転方向の出力ポート（PIO2_0/1, PIO2_2/3）を両方とも 'H' とすれば、
+ * 原理上は短絡（回生）ブレーキとなるが、停止指示だけでは効果は観測されず、
+ * また停止し続けた場合は僅かながら電力を消費することになるため、
+ * 既定値はフリーとする。減速を強めたい場合は PWM_BRAKE_REVERSE により、
+ * 逆転パルスで運動エネルギーを打ち消してから短絡ブレーキをかける。
+ *----------------------------------------------------------------------*/
+static volatile int brakeMode = PWM_BRAKE_COAST;
+
+// PWM_BRAKE_REVERSE の停止指示で使用するブレーキ動作
+static PwmBrakeProfile_t brakeProfile = {
+	PWM_MAX / 2,	// 逆転パルスのデューティ
+	20,				// 逆転パルスの時間[msec]
+	50,				// 短絡ブレーキの時間[msec]
+};
+
+/*----------------------------------------------------------------------
+ * 車輪ごとの出力状態
+ *----------------------------------------------------------------------*/
+#define	BRAKE_NONE		0	// ブレーキ動作なし
+#define	BRAKE_AUTO		1	// 停止指示による逆転パルス（再び駆動すれば解除）
+#define	BRAKE_PROFILE	2	// pwmBrake() によるブレーキ（指定時間が経過するまで継続）
+
+typedef struct {
+	int value;				// 指示値（補正後、前進が正）
+	int last;				// 最後に駆動した回転方向（+1：正転、-1：逆転）
+	unsigned char brake;	// ブレーキ動作の種類
+	unsigned long start;	// ブレーキを開始したPWM周期カウンタ
+	unsigned long reverse;	// 逆転パルスを終える経過周期数
+	unsigned long hold;		// 短絡ブレーキを終える経過周期数
+	unsigned short duty;	// 逆転パルスのデューティ
+} PwmWheel_t;
+
+static volatile PwmWheel_t pwmWheel[2];
+
+/*----------------------------------------------------------------------
+ * 停止距離計測用のフック関数と計測結果
+ *----------------------------------------------------------------------*/
+static int (*brakeHook)(unsigned long ticks) = 0;
+static volatile unsigned long brakeStart = 0;	// ブレーキを開始したPWM周期カウンタ
+static volatile unsigned long brakeStop  = 0;	// 停止と判定されるまでのPWM周期数
+
+/*----------------------------------------------------------------------
+ * 不感帯・非線形性の補正テーブル [車輪][回転方向][折れ線の点]
+ * - 初期値は補正なし（指示値 = デューティ値）とする
+ *----------------------------------------------------------------------*/
+#define	PWM_COMP_LINEAR	{0, 8192, 16384, 24576, 32768, 40960, 49152, 57344, PWM_MAX}
+
+static unsigned short compTable[2][2][PWM_COMP_POINTS] = {
+	{PWM_COMP_LINEAR, PWM_COMP_LINEAR},	// PWM_WHEEL_L: 正転、逆転
+	{PWM_COMP_LINEAR, PWM_COMP_LINEAR},	// PWM_WHEEL_R: 正転、逆転
+};
+
+static unsigned char compEnable = FALSE;	// TRUE: 補正テーブルを適用する
+
+/*----------------------------------------------------------------------
+ * モーター指示の調停 - 指示元ごとの指示値と有効期間
+ *----------------------------------------------------------------------*/
+typedef struct {
+	int L;					// 左モーターへの指示値
+	int R;					// 右モーターへの指示値
+	unsigned long start;	// 指示を受け付けた時点のPWM周期カウンタ
+	unsigned long ticks;	// 有効期間（PWM周期数）、0 = 有効期間なし
+	unsigned char valid;	// 1 = 指示が有効
+} PwmCommand_t;
+
+static volatile PwmCommand_t pwmCommand[PWM_SRC_NUM];
+static volatile unsigned long pwmTick = 0;		// PWM周期ごとのカウンタ
+static volatile int pwmWinner = PWM_SRC_NUM;	// 出力中の指示元
+static unsigned long pwmTickHz = 0;				// PWM周期の周波数[Hz]
+
+/*----------------------------------------------------------------------
+ * PWM指示値を補正テーブルで線形補間し、符号付きのデューティ値に変換する
+ * - 停止指示（0）は、不感帯によらず 0 のままとする
+ *----------------------------------------------------------------------*/
+static int compensate(int wheel, int value) {
+	const unsigned short *t;
+	int x, i, f;
+
+	if (value == 0) {
+		return 0;
+	}
+
+	t = compTable[wheel][value > 0 ? PWM_DIR_FWD : PWM_DIR_REV];
+	x = MIN(ABS(value), PWM_MAX);
+	i = x >> PWM_COMP_SHIFT;		// 区間の番号
+	f = x & (PWM_COMP_STEP - 1);	// 区間内の位置
+
+	// 除算を使わず、区間幅（2のべき乗）のシフトで補間する
+	x = t[i] + ((((int)t[i + 1] - (int)t[i]) * f) >> PWM_COMP_SHIFT);
+
+	return value > 0 ? x : -x;
+}
+
+/*----------------------------------------------------------------------
+ * 電源電圧を測定し、補正係数を更新する
+ * - 補正係数 = 基準電圧 ÷ 電源電圧（0.5 ～ 2.0 倍に制限）
+ * - 下限より低い電圧は配線の外れなどの異常とみなし、補正しない（1.0 倍）
+ *----------------------------------------------------------------------*/
+static void updateSupply(void) {
+	unsigned long v;
+
+	vbatFilter += adcReadVoltage() - (vbatFilter >> PWM_VBAT_FILTER);
+
+	v = vbatFilter >> PWM_VBAT_FILTER;
+	if (v < PWM_VBAT_MIN(vbatNominal)) {
+		vbatScale = (1 << PWM_VBAT_SHIFT);
+		return;
+	}
+
+	v = ((unsigned long)vbatNominal << PWM_VBAT_SHIFT) / v;
+	vbatScale = MAX((1 << PWM_VBAT_SHIFT) / 2, MIN(v, (1 << PWM_VBAT_SHIFT) * 2));
+}
+
+/*----------------------------------------------------------------------
+ * 電源電圧による補正を有効／無効にする
+ * - adcInit() で電源電圧（ADC_VBAT）のA/D変換を開始しておくこと
+ * - 電源電圧が下限（基準電圧の半分）より低い場合は、分圧回路が配線されて
+ *   いないとみなし、有効にしない
+ * - 戻り値 TRUE: 補正が有効、FALSE: 補正が無効
+ *----------------------------------------------------------------------*/
+int pwmSupplyComp(int enable) {
+	if (enable) {
+		unsigned short mv = adcReadVoltage();
+
+		if (mv < PWM_VBAT_MIN(vbatNominal)) {
+			vbatEnable = FALSE;
+			vbatScale = (1 << PWM_VBAT_SHIFT);
+			return FALSE;
+		}
+
+		// 現在の電圧でフィルタを初期化する
+		vbatFilter = (unsigned long)mv << PWM_VBAT_FILTER;
+		updateSupply();
+	}
+
+	vbatEnable = (enable ? TRUE : FALSE);
+	return vbatEnable;
+}
+
+/*----------------------------------------------------------------------
+ * 基準電圧[mV]を設定する - ゲインを調整した時の電池電圧を指定する
+ *----------------------------------------------------------------------*/
+void pwmSetNominalVoltage(unsigned short mv) {
+	if (mv) {
+		vbatNominal = mv;
+	}
+}
+
+/*----------------------------------------------------------------------
+ * 電源電圧[mV]（フィルタ後）を取得する
+ *----------------------------------------------------------------------*/
+unsigned short pwmGetVoltage(void) {
+	return (unsigned short)(vbatFilter >> PWM_VBAT_FILTER);
+}
+
+/*----------------------------------------------------------------------
+ * 不感帯・非線形性の補正を有効／無効にする
+ *----------------------------------------------------------------------*/
+void pwmCompensate(int enable) {
+	compEnable = (enable ? TRUE : FALSE);
+}
+
+/*----------------------------------------------------------------------
+ * 補正テーブルを設定する
+ * - table: PWM_COMP_POINTS 点のデューティ値（0～PWM_MAX）
+ *----------------------------------------------------------------------*/
+void pwmSetCompTable(int wheel, int dir, const unsigned short *table) {
+	int i;
+
+	// 車輪、回転方向は 0 あるいは 1 のみ
+	wheel &= 0x01;
+	dir   &= 0x01;
+
+	for (i = 0; i < PWM_COMP_POINTS; i++) {
+		compTable[wheel][dir][i] = table[i];
+	}
+}
+
+/*----------------------------------------------------------------------
+ * 回り始めるデューティ（不感帯）から PWM_MAX までを線形に割り付ける
  *----------------------------------------------------------------------*/
-#define	STOP_BRAKE	FALSE
+void pwmSetDeadZone(int wheel, int dir, unsigned short duty) {
+	int i;
+	unsigned short t[PWM_COMP_POINTS];
+
+	for (i = 0; i < PWM_COMP_POINTS; i++) {
+		t[i] = duty + (unsigned long)(PWM_MAX - duty) * i / (PWM_COMP_POINTS - 1);
+	}
+
+	pwmSetCompTable(wheel, dir, t);
+}
+
+/*----------------------------------------------------------------------
+ * デューティと車輪速度の計測値から補正テーブルを作成する
+ * - speed: デューティ i × PWM_COMP_STEP（i = 0～PWM_COMP_POINTS-1）で計測した
+ *          車輪速度（単位は任意、単調増加であること）
+ * - 指示値が速度に比例するよう、計測値の逆関数を折れ線で求める
+ *----------------------------------------------------------------------*/
+#define	COMP_DUTY(i)	MIN((long)(i) * PWM_COMP_STEP, PWM_MAX)
+
+void pwmBuildCompTable(int wheel, int dir, const unsigned short *speed) {
+	int j, k = 0;
+	long v, ds;
+	unsigned short t[PWM_COMP_POINTS];
+
+	for (j = 0; j < PWM_COMP_POINTS; j++) {
+		// 指示値 j に対応させる目標速度
+		v = (long)speed[PWM_COMP_POINTS - 1] * j / (PWM_COMP_POINTS - 1);
+
+		// 目標速度を含む区間を探す（速度が変化しない区間は読み飛ばす）
+		while (k < PWM_COMP_POINTS - 2 && (speed[k + 1] < v || speed[k + 1] == speed[k])) {
+			k++;
+		}
+
+		// 区間内のデューティを線形補間する
+		ds = speed[k + 1] - speed[k];
+		if (ds > 0) {
+			t[j] = COMP_DUTY(k) + (COMP_DUTY(k + 1) - COMP_DUTY(k)) * MAX(0, v - speed[k]) / ds;
+		} else {
+			t[j] = COMP_DUTY(k + 1);
+		}
+	}
+
+	pwmSetCompTable(wheel, dir, t);
+}
 
 /*----------------------------------------------------------------------
  * PWM出力の初期化 - I/Oピン、タイマの設定
@@ -63,11 +305,16 @@ void pwmInit(void) {
 
 	// 9.4.1 GPIO data register
 	// Bit 11:0 (DATA): Logic levels for pins PIOn_0 to PIOn_11. HIGH=1, LOW=0
-	LPC_GPIO2->DATA &= ~0x0FFF; // Clear motor bit
+	gpioPinWrite(PWM_PINS_DIR, 0); // Clear motor bit
 
 	/*-----------------------------------------
 	 * TMR16B0, TMR16B1 Configuration
 	 *-----------------------------------------*/
+	// CT16B0: MR0（MTR1のPWM）、MR1（PWM周期の割込み）
+	// CT16B1: MR0（MTR2のPWM）
+	timerClaim(TMR_16B0, TMR_COUNTER | TMR_MR0 | TMR_MR1, "pwm");
+	timerClaim(TMR_16B1, TMR_COUNTER | TMR_MR0, "pwm");
+
 	// 3.5.18 System AHB clock control register
 	// Bit 7 (CT16B0): Enables clock for 16-bit counter/timer 0
 	// Bit 8 (CT16B1): Enables clock for 16-bit counter/timer 1
@@ -98,7 +345,8 @@ void pwmInit(void) {
 
 	// 15.8.6 Match Control Register (TMR16B0MCR, TMR16B1MCR)
 	// Bit 11:0 (MRn[IRS]): Interrupt(I), Reset(R), Stop(S) when MRn matches TC
-	LPC_TMR16B0->MCR = 0; // Disable operations when MR0 matches TC
+	// Bit 3 (MR1I): Interrupt on MR1 - 調停と有効期間の監視をPWM周期ごとに行う
+	LPC_TMR16B0->MCR = (1<<3); // Interrupt when MR1 matches TC
 	LPC_TMR16B1->MCR = 0; // Disable operations when MR0 matches TC
 
 	// 15.8.7 Match Registers (TMR16B0MR0, TMR16B1MR0)
@@ -106,6 +354,15 @@ void pwmInit(void) {
 	// Bit 15:0 (MATCH): Timer counter match value
 	LPC_TMR16B0->MR0 = ~0x0000; // Set duty 0% for MTR1
 	LPC_TMR16B1->MR0 = ~0x0000; // Set duty 0% for MTR2
+	LPC_TMR16B0->MR1 = 0;       // PWM周期の先頭で割り込む
+
+	// PWM周期 = PCLK ÷ 65536 ≒ 1.1[KHz]
+	pwmTickHz = clkGetMainClock() >> 16;
+
+	// 6.6.2 Interrupt Set-Enable Register 1 (ISER1)
+	// Bit 9 (ISE_CT16B0): Enable timer CT16B0 interrupt
+	NVIC_ClearPendingIRQ(TIMER_16_0_IRQn);
+	NVIC_EnableIRQ(TIMER_16_0_IRQn);
 
 	// 15.8.2 Timer Control Register (TMR16B0TCR, TMR16B1TCR)
 	// Bit 0 (CEN): 1=Enable TC and PC for counting, 0=Disable
@@ -113,6 +370,132 @@ void pwmInit(void) {
 	LPC_TMR16B1->TCR |= 0x01; // Enable counter (Timer start)
 }
 
+/*----------------------------------------------------------------------
+ * [msec]をPWM周期数に変換する（切り上げ）
+ *----------------------------------------------------------------------*/
+static unsigned long msecToTicks(unsigned long msec) {
+	return (msec / 1000) * pwmTickHz + ((msec % 1000) * pwmTickHz + 999) / 1000;
+}
+
+/*----------------------------------------------------------------------
+ * ブレーキ動作を開始する
+ *----------------------------------------------------------------------*/
+static void startBrake(int wheel, int kind, const PwmBrakeProfile_t *p) {
+	volatile PwmWheel_t *w = &pwmWheel[wheel];
+
+	w->brake   = kind;
+	w->start   = pwmTick;
+	w->reverse = msecToTicks(p->reverse);
+	w->hold    = w->reverse + msecToTicks(p->hold);
+	w->duty    = p->duty;
+
+	brakeStart = pwmTick;
+	brakeStop  = 0;
+}
+
+/*----------------------------------------------------------------------
+ * 車輪の回転方向とデューティを決める
+ * - 戻り値は回転方向の出力ポート（上位ビット：PIO2_1/3、下位ビット：PIO2_0/2）
+ *----------------------------------------------------------------------*/
+#define	OUT_FREE	((0<<1)|(0<<0))	// 停止（フリー）
+#define	OUT_FWD		((0<<1)|(1<<0))	// 正転
+#define	OUT_REV		((1<<1)|(0<<0))	// 逆転
+#define	OUT_BRAKE	((1<<1)|(1<<0))	// 停止（ブレーキ）
+
+static int wheelOutput(int wheel, int *duty) {
+	volatile PwmWheel_t *w = &pwmWheel[wheel];
+
+	if (w->brake) {
+		unsigned long t = pwmTick - w->start;
+
+		// 最後に駆動した方向と逆向きに、指定のデューティで駆動する
+		// 一度も駆動していない車輪（last = 0）は逆転パルスを出さず短絡ブレーキとする
+		if (t < w->reverse) {
+			if (!w->last) {
+				*duty = 0;
+				return OUT_BRAKE;
+			}
+			*duty = w->duty;
+			return w->last > 0 ? OUT_REV : OUT_FWD;
+		}
+
+		// 短絡ブレーキ
+		if (t < w->hold) {
+			*duty = 0;
+			return OUT_BRAKE;
+		}
+
+		// ブレーキ動作の終了
+		w->brake = BRAKE_NONE;
+	}
+
+	if (w->value > 0) {
+		*duty = w->value;
+		return OUT_FWD;
+	}
+	else if (w->value < 0) {
+		*duty = -w->value;
+		return OUT_REV;
+	}
+	else {
+		*duty = 0;
+		return brakeMode == PWM_BRAKE_COAST ? OUT_FREE : OUT_BRAKE;
+	}
+}
+
+/*----------------------------------------------------------------------
+ * 出力状態をI/Oポートとタイマに反映する
+ *----------------------------------------------------------------------*/
+static void update(void) {
+	int dutyL, dutyR;
+
+	// モーター回転方向の指示値
+	int dir;
+
+	dir  = (wheelOutput(PWM_WHEEL_L, &dutyL) << 2);	// PIO2_3, PIO2_2
+	dir |= (wheelOutput(PWM_WHEEL_R, &dutyR) << 0);	// PIO2_1, PIO2_0
+
+	// 9.4.1 GPIO data register
+	// モーター回転方向を指示
+	// PIO2_0 ～PIO2_3 だけをマスクして書き込み、他のビットは読み出さずに維持する
+	gpioPinWrite(PWM_PINS_DIR, dir);
+
+	// 15.8.7 Match Registers (TMR16B0MR0, TMR16B1MR0)
+	// モーターに出力値を設定
+	// TC = 0 ～ 65535
+	// MR0 = 65535 の場合: Duty   0%
+	// MR0 =     0 の場合: Duty 100%
+	//            <----- |L| or |R|
+	//            +----+ High
+	//            |    |
+	// +----------+    + Low
+	// <-- PWM Cycle -->
+	LPC_TMR16B0->MR0 = ~dutyR & 0xFFFF;
+	LPC_TMR16B1->MR0 = ~dutyL & 0xFFFF;
+}
+
+/*----------------------------------------------------------------------
+ * 車輪の指示値を更新する
+ * - PWM_BRAKE_REVERSE の場合、駆動中の車輪への停止指示で逆転パルスを開始する
+ *----------------------------------------------------------------------*/
+static void setWheel(int wheel, int value) {
+	volatile PwmWheel_t *w = &pwmWheel[wheel];
+
+	if (value) {
+		w->last = (value > 0 ? +1 : -1);
+
+		// 再び駆動する場合は、停止指示による逆転パルスを解除する
+		if (w->brake == BRAKE_AUTO) {
+			w->brake = BRAKE_NONE;
+		}
+	}
+	else if (w->value && w->brake == BRAKE_NONE && brakeMode == PWM_BRAKE_REVERSE) {
+		startBrake(wheel, BRAKE_AUTO, &brakeProfile);
+	}
+
+	w->value = value;
+}
+
 /*----------------------------------------------------------------------
  * PWM出力 - I/Oポートへの出力
  * ・R： PIO2_0、PIO2_1 (方向出力)、PIO0_8 (PWM、CT16B0_MAT0)
@@ -130,57 +513,264 @@ void pwmInit(void) {
  *	※ 両輪とも、前進が正（+）、後退が負（-）をPWM指示値とする
  *----------------------------------------------------------------------*/
 void pwmOut(int L, int R) {
-	// モーター回転方向の指示値
-	// PIO2_0 ～PIO2_3 を 'L' に初期化
-	int dir = LPC_GPIO2->DATA & 0x0ff0;
+	unsigned long primask;
 
-	if (L > 0) {
-		dir |= (0<<3)|(1<<2);	// 正転：PIO2_3=L, PIO2_2=H
+	// 左右駆動系のバラツキを補正する
+	L = (L * PWM_GAIN_L) / PWM_GAIN_RATIO;
+	R = (R * PWM_GAIN_R) / PWM_GAIN_RATIO;
+
+	// 不感帯・非線形性を補正する
+	if (compEnable) {
+		L = compensate(PWM_WHEEL_L, L);
+		R = compensate(PWM_WHEEL_R, R);
 	}
-	else if (L < 0) {
-		dir |= (1<<3)|(0<<2);	// 逆転：PIO2_3=H, PIO2_2=L
+
+	// 電源電圧の低下分だけデューティを上げる
+	if (vbatEnable) {
+		L = (MAX(-PWM_MAX, MIN(L, PWM_MAX)) * (int)vbatScale) >> PWM_VBAT_SHIFT;
+		R = (MAX(-PWM_MAX, MIN(R, PWM_MAX)) * (int)vbatScale) >> PWM_VBAT_SHIFT;
+		L = MAX(-PWM_MAX, MIN(L, PWM_MAX));
+		R = MAX(-PWM_MAX, MIN(R, PWM_MAX));
 	}
 
-#if	STOP_BRAKE
-	else {
-		dir |= (1<<3)|(1<<2);	// 停止：PIO2_3=H, PIO2_2=H
+	// PWM周期ごとの割込みと競合しないよう、割込み禁止で更新する
+	primask = __get_PRIMASK();
+	__disable_irq();
+
+	setWheel(PWM_WHEEL_L, L);
+	setWheel(PWM_WHEEL_R, R);
+	update();
+
+	__set_PRIMASK(primask);
+}
+
+/*----------------------------------------------------------------------
+ * 停止時の出力モードを設定する
+ * - profile: PWM_BRAKE_REVERSE で使用するブレーキ動作（NULL の場合は変更しない）
+ *----------------------------------------------------------------------*/
+void pwmSetBrakeMode(int mode, const PwmBrakeProfile_t *profile) {
+	unsigned long primask;
+
+	switch (mode) {
+	  case PWM_BRAKE_COAST:
+	  case PWM_BRAKE_SHORT:
+	  case PWM_BRAKE_REVERSE:
+		break;
+	  default:
+		return;
 	}
-#endif
 
-	if (R > 0) {
-		dir |= (0<<1)|(1<<0);	// 正転：PIO2_1=L, PIO2_0=H
+	primask = __get_PRIMASK();
+	__disable_irq();
+
+	brakeMode = mode;
+	if (profile) {
+		brakeProfile = *profile;
 	}
-	else if (R < 0) {
-		dir |= (1<<1)|(0<<0);	// 逆転：PIO2_1=H, PIO2_0=L
+	update();
+
+	__set_PRIMASK(primask);
+}
+
+/*----------------------------------------------------------------------
+ * 走行中のブレーキ - 逆転パルスと短絡ブレーキを指定時間だけ行う
+ * - ブレーキ中の指示値は保持され、ブレーキ終了後に出力される
+ * - 出力する指示元が変わった場合（非常停止など）はブレーキを中止する
+ * - 非常停止中は逆転パルスを出さないよう何もしない
+ *----------------------------------------------------------------------*/
+void pwmBrake(const PwmBrakeProfile_t *profile) {
+	unsigned long primask;
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+
+	if (pwmWinner == PWM_SRC_SAFETY) {
+		__set_PRIMASK(primask);
+		return;
 	}
 
-#if	STOP_BRAKE
-	else {
-		dir |= (1<<1)|(1<<0);	// 停止：PIO2_1=H, PIO2_0=H
+	startBrake(PWM_WHEEL_L, BRAKE_PROFILE, profile);
+	startBrake(PWM_WHEEL_R, BRAKE_PROFILE, profile);
+	update();
+
+	__set_PRIMASK(primask);
+}
+
+/*----------------------------------------------------------------------
+ * ブレーキ動作中か調べる
+ *----------------------------------------------------------------------*/
+int pwmIsBraking(void) {
+	return pwmWheel[PWM_WHEEL_L].brake || pwmWheel[PWM_WHEEL_R].brake;
+}
+
+/*----------------------------------------------------------------------
+ * 停止距離計測用のフック関数を登録する
+ * - ブレーキ中にPWM周期ごとに呼び出され、ticks はブレーキ開始からのPWM周期数
+ * - 停止したと判定したら非0を返す（割込みハンドラから呼び出されることに注意）
+ *----------------------------------------------------------------------*/
+void pwmSetBrakeHook(int (*f)(unsigned long ticks)) {
+	brakeHook = f;
+}
+
+/*----------------------------------------------------------------------
+ * 直近のブレーキで停止と判定されるまでのPWM周期数（0 = 未判定）
+ *----------------------------------------------------------------------*/
+unsigned long pwmBrakeTicks(void) {
+	return brakeStop;
+}
+
+/*----------------------------------------------------------------------
+ * 非常停止の出力
+ * - ブレーキ動作をすべて中止し、PWM_BRAKE_REVERSE でも逆転パルスを出さずに
+ *   停止（PWM_BRAKE_COAST：フリー、それ以外：短絡ブレーキ）を直接出力する
+ * - 割込み禁止の状態で呼び出すこと
+ *----------------------------------------------------------------------*/
+static void safeStop(void) {
+	int wheel;
+
+	for (wheel = 0; wheel < 2; wheel++) {
+		pwmWheel[wheel].brake = BRAKE_NONE;
+		pwmWheel[wheel].value = 0;
 	}
-#endif
 
-	// 9.4.1 GPIO data register
-	// Bit 11:0 DATA
-	// モーター回転方向を指示
-	LPC_GPIO2->DATA = dir;
+	update();
+}
 
-	// 左右駆動系のバラツキを補正する
-	L = (L * PWM_GAIN_L) / PWM_GAIN_RATIO;
-	R = (R * PWM_GAIN_R) / PWM_GAIN_RATIO;
+/*----------------------------------------------------------------------
+ * モーター指示の調停
+ * - 優先度の高い指示元から順に、有効期間内の指示を探して出力する
+ * - 出力する指示元が変わった場合、または updated が出力する指示元の場合のみ
+ *   モーターへの出力を更新する
+ * - 割込み禁止の状態で呼び出すこと
+ *----------------------------------------------------------------------*/
+static void arbitrate(int updated) {
+	int src;
+
+	for (src = 0; src < PWM_SRC_NUM; src++) {
+		if (pwmCommand[src].valid) {
+			// 有効期間を過ぎた指示は無効とする
+			if (pwmCommand[src].ticks && pwmTick - pwmCommand[src].start >= pwmCommand[src].ticks) {
+				pwmCommand[src].valid = 0;
+			} else {
+				break;
+			}
+		}
+	}
 
-	// 15.8.7 Match Registers (TMR16B0MR0, TMR16B1MR0)
-	// モーターに出力値を設定
-	// TC = 0 ～ 65535
-	// MR0 = 65535 の場合: Duty   0%
-	// MR0 =     0 の場合: Duty 100%
-	//            <----- |L| or |R|
-	//            +----+ High
-	//            |    |
-	// +----------+    + Low
-	// <-- PWM Cycle -->
-	LPC_TMR16B0->MR0 = ~ABS(R) & 0xFFFF;
-	LPC_TMR16B1->MR0 = ~ABS(L) & 0xFFFF;
+	if (src != pwmWinner || src == updated) {
+		// 出力する指示元が変わった場合は、走行中のブレーキを中止する
+		if (src != pwmWinner) {
+			if (pwmWheel[PWM_WHEEL_L].brake == BRAKE_PROFILE) pwmWheel[PWM_WHEEL_L].brake = BRAKE_NONE;
+			if (pwmWheel[PWM_WHEEL_R].brake == BRAKE_PROFILE) pwmWheel[PWM_WHEEL_R].brake = BRAKE_NONE;
+		}
+
+		pwmWinner = src;
+
+		if (src == PWM_SRC_SAFETY) {
+			safeStop(); // 非常停止ではモーターを駆動しない
+		} else if (src < PWM_SRC_NUM) {
+			pwmOut(pwmCommand[src].L, pwmCommand[src].R);
+		} else {
+			pwmOut(0, 0); // 有効な指示がなければ停止する
+		}
+	}
+}
+
+/*----------------------------------------------------------------------
+ * 指示元 src からのモーター指示
+ * - msec: 指示の有効期間[msec]、PWM_NO_TIMEOUT の場合は pwmRelease() まで有効
+ *----------------------------------------------------------------------*/
+void pwmRequest(int src, int L, int R, unsigned long msec) {
+	unsigned long primask;
+
+	if (src < 0 || PWM_SRC_NUM <= src) {
+		return;
+	}
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+
+	pwmCommand[src].L = L;
+	pwmCommand[src].R = R;
+	pwmCommand[src].start = pwmTick;
+	pwmCommand[src].ticks = msecToTicks(msec);
+	pwmCommand[src].valid = 1;
+
+	arbitrate(src);
+
+	__set_PRIMASK(primask);
+}
+
+/*----------------------------------------------------------------------
+ * 指示元 src からの指示を取り消す
+ *----------------------------------------------------------------------*/
+void pwmRelease(int src) {
+	unsigned long primask;
+
+	if (src < 0 || PWM_SRC_NUM <= src) {
+		return;
+	}
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+
+	pwmCommand[src].valid = 0;
+	arbitrate(-1);
+
+	__set_PRIMASK(primask);
+}
+
+/*----------------------------------------------------------------------
+ * 非常停止 - pwmRelease(PWM_SRC_SAFETY) まで停止し続ける
+ * - 割込みハンドラから呼び出してもよい
+ * - ブレーキ動作は中止し、逆転パルスは出さない（safeStop()）
+ *----------------------------------------------------------------------*/
+void pwmEmergencyStop(void) {
+	pwmRequest(PWM_SRC_SAFETY, 0, 0, PWM_NO_TIMEOUT);
+}
+
+/*----------------------------------------------------------------------
+ * 出力中の指示元を返す（PWM_SRC_NUM = 有効な指示なし）
+ *----------------------------------------------------------------------*/
+int pwmSource(void) {
+	return pwmWinner;
+}
+
+/*----------------------------------------------------------------------
+ * タイマCT16B0 割り込みハンドラ - PWM周期ごとに指示の有効期間とブレーキ動作を監視する
+ * - 電源電圧による補正が有効な場合は、電源電圧も測定する
+ * - メイン処理が停止しても、有効期間を過ぎればモーターは停止する
+ *----------------------------------------------------------------------*/
+void TIMER16_0_IRQHandler(void) {
+	int braking;
+	unsigned long ticks;
+
+	// 15.8.1 Interrupt Register (TMR16B0IR)
+	// Bit 1 (MR1INT): Writing '1' will reset the interrupt
+	LPC_TMR16B0->IR = (1<<1);
+
+	// 電源電圧を測定する（補正係数は次の pwmOut() から反映される）
+	if (vbatEnable) {
+		updateSupply();
+	}
+
+	// 非常停止などの割込みと競合しないよう、割込み禁止で調停する
+	__disable_irq();
+	pwmTick++;
+	arbitrate(-1);
+
+	// ブレーキ動作を進める
+	braking = pwmIsBraking();
+	if (braking) {
+		update();
+	}
+	ticks = pwmTick - brakeStart;
+	__enable_irq();
+
+	// 停止と判定されるまでの周期数を記録する
+	if (braking && brakeHook && !brakeStop && brakeHook(ticks)) {
+		brakeStop = ticks;
+	}
 }
 
 #ifdef	EXAMPLE
@@ -203,22 +793,22 @@ void pwmExample1(void) {
 	while (1) {
 		// 前進
 		for (pwm = 0; pwm <= PWM_MAX; pwm += delta) {
-			pwmOut(pwm, pwm);
+			pwmRequest(PWM_SRC_MANUAL, pwm, pwm, PWM_NO_TIMEOUT);
 			timerWait(10);
 		}
 
 		// 停止
-		pwmOut(0, 0);
+		pwmRequest(PWM_SRC_MANUAL, 0, 0, PWM_NO_TIMEOUT);
 		timerWait(1000);
 
 		// 後退
 		for (pwm = 0; pwm <= PWM_MAX; pwm += delta) {
-			pwmOut(-pwm, -pwm);
+			pwmRequest(PWM_SRC_MANUAL, -pwm, -pwm, PWM_NO_TIMEOUT);
 			timerWait(10);
 		}
 
 		// 停止
-		pwmOut(0, 0);
+		pwmRequest(PWM_SRC_MANUAL, 0, 0, PWM_NO_TIMEOUT);
 		timerWait(1000);
 
 		// スイッチが押されるまで待機
@@ -234,18 +824,59 @@ void pwmExample2(void) {
 	int pwm = PWM_MAX / 2; // デューティ50%で動作
 
 	while (1) {
-		pwmOut(+pwm, +pwm); timerWait(1000); // 前進
-		pwmOut(   0,    0); timerWait(1000); // 停止
+		pwmRequest(PWM_SRC_MANUAL, +pwm, +pwm, PWM_NO_TIMEOUT); timerWait(1000); // 前進
+		pwmRequest(PWM_SRC_MANUAL,    0,    0, PWM_NO_TIMEOUT); timerWait(1000); // 停止
+
+		pwmRequest(PWM_SRC_MANUAL, +pwm, -pwm, PWM_NO_TIMEOUT); timerWait(1000); // 右回転
+		pwmRequest(PWM_SRC_MANUAL,    0,    0, PWM_NO_TIMEOUT); timerWait(1000); // 停止
 
-		pwmOut(+pwm, -pwm); timerWait(1000); // 右回転
-		pwmOut(   0,    0); timerWait(1000); // 停止
+		pwmRequest(PWM_SRC_MANUAL, -pwm, +pwm, PWM_NO_TIMEOUT); timerWait(1000); // 左回転
+		pwmRequest(PWM_SRC_MANUAL,    0,    0, PWM_NO_TIMEOUT); timerWait(1000); // 停止
 
-		pwmOut(-pwm, +pwm); timerWait(1000); // 左回転
-		pwmOut(   0,    0); timerWait(1000); // 停止
+		pwmRequest(PWM_SRC_MANUAL, -pwm, -pwm, PWM_NO_TIMEOUT); timerWait(1000); // 後退
+		pwmRequest(PWM_SRC_MANUAL,    0,    0, PWM_NO_TIMEOUT); timerWait(1000); // 停止
+	}
+}
 
-		pwmOut(-pwm, -pwm); timerWait(1000); // 後退
-		pwmOut(   0,    0); timerWait(1000); // 停止
+/*----------------------------------------------------------------------
+ * 動作例3: 各車輪が回り始めるデューティ（不感帯）を計測し、補正テーブルを作成する
+ * - 左正転 → 左逆転 → 右正転 → 右逆転 の順に、スイッチを押すと計測を開始する
+ * - デューティを徐々に上げ、車輪が回り始めたらスイッチを押す
+ * - 計測後は補正を有効にして、動作例1で直進性を確認する
+ *----------------------------------------------------------------------*/
+void pwmExample3(void) {
+	int wheel, dir, duty, pwm, delta = PWM_MAX / 200;
+
+	// 計測中は補正しない
+	pwmCompensate(FALSE);
+
+	for (wheel = PWM_WHEEL_L; wheel <= PWM_WHEEL_R; wheel++) {
+		for (dir = PWM_DIR_FWD; dir <= PWM_DIR_REV; dir++) {
+			// スイッチが押されるまで待機
+			while (!swClick()) { ledFlush(100); }
+			ledOn(wheel == PWM_WHEEL_L ? LED1 : LED2);
+
+			for (duty = 0; duty < PWM_MAX; duty += delta) {
+				pwm = (dir == PWM_DIR_FWD ? duty : -duty);
+				pwmRequest(PWM_SRC_MANUAL, wheel == PWM_WHEEL_L ? pwm : 0, wheel == PWM_WHEEL_R ? pwm : 0, PWM_NO_TIMEOUT);
+
+				// 回り始めたらスイッチを押す（デューティを約50[msec]ごとに上げる）
+				if (swScan() == SW_ON) {
+					break;
+				}
+				timerWait(50);
+			}
+
+			// 停止
+			pwmRequest(PWM_SRC_MANUAL, 0, 0, PWM_NO_TIMEOUT);
+			pwmSetDeadZone(wheel, dir, MIN(duty, PWM_MAX));
+			while (swScan() == SW_ON);
+		}
 	}
+
+	// 補正を有効にして直進性を確認する
+	pwmCompensate(TRUE);
+	pwmExample1();
 }
 
 /*----------------------------------------------------------------------
@@ -253,6 +884,7 @@ void pwmExample2(void) {
  * - exampleType
  *	1: 直進性を確認し、駆動系のゲインを調整する
  *	2: 前進 --> 右旋回 --> 左旋回 --> 後退
+ *	3: 不感帯を計測し、補正テーブルを作成する
  *----------------------------------------------------------------------*/
 void pwmExample(int exampleType) {
 	timerInit();	// timerWait()
@@ -269,6 +901,10 @@ void pwmExample(int exampleType) {
 		pwmExample1();
 		break;
 
+	  case 3:
+		pwmExample3();
+		break;
+
 	  case 2:
 	  default:
 		pwmExample2();
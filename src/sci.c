@@ -16,6 +16,7 @@
 #include <stdarg.h>
 
 #include "type.h"
+#include "timer.h"
 #include "sci.h"
 
 #include "usb.h"
@@ -31,8 +32,7 @@
  * 待ち時間の設定
  * - 連続送出時、5[msec]の設定だと、受信側で取りこぼしが発生する
  *----------------------------------------------------------------------*/
-#define	SCI_WAIT	(2000UL * 10)		// [10msec]
-extern void delay	(uint32_t length);	// defined in usbhw.c
+#define	SCI_WAIT	10000UL		// [μsec]
 
 /*----------------------------------------------------------------------
  * シリアル通信I/F - 初期化
@@ -74,7 +74,7 @@ int sciPrintf(const char* restrict fmt, ...) {
 	SciStrTx((unsigned char*)buf, (unsigned char)len);
 
 	// 次の送信まで間を空ける
-	delay(SCI_WAIT);
+	timerDelayUs(SCI_WAIT);
 
 	return len;
 }
@@ -232,7 +232,7 @@ int __sys_write(int iFileHandle, char *pcBuffer, int iLength) {
 		SciStrTx((unsigned char*)pcBuffer, (unsigned char)len);
 
 		// 次の送信まで間を空ける
-		delay(SCI_WAIT);
+		timerDelayUs(SCI_WAIT);
 
 		pcBuffer += len;
 		iLength  -= len;
@@ -0,0 +1,71 @@
+/*===============================================================================
+ * Name        : score.c
+ * Author      : $(author)
+ * Version     :
+ * CPU type    : ARM Cortex-M3 LPC1343
+ * Copyright   : $(copyright)
+ * Description : Flash-resident music score registry
+ *===============================================================================*/
+// Cortex Microcontroller Software Interface Standard
+#ifdef __USE_CMSIS
+#include "LPC13xx.h"
+#endif
+
+#include "type.h"
+#include "play.h"
+#include "score.h"
+
+/*----------------------------------------------------------------------
+ * 楽譜データ（tools/dat2pk.py で *.dat から生成）
+ *----------------------------------------------------------------------*/
+static const PackedScore_t doremi[] SCORE_FLASH = {
+#include "doremi_pk.dat"
+};
+
+static const PackedScore_t lupin[] SCORE_FLASH = {
+#include "lupin_pk.dat"
+};
+
+static const PackedScore_t truth[] SCORE_FLASH = {
+#include "truth_pk.dat"
+};
+
+#define	SCORE(s)	(s), sizeof(s) / sizeof(PackedScore_t)
+
+/*----------------------------------------------------------------------
+ * 登録表（SCORE_DOREMI ～ SCORE_TRUTH の順）
+ *----------------------------------------------------------------------*/
+static const Score_t scoreTable[SCORE_NUM] SCORE_FLASH = {
+	[SCORE_DOREMI] = {"doremi", SCORE(doremi), PLAY_BASE_TEMPO},
+	[SCORE_LUPIN]  = {"lupin",  SCORE(lupin),  132},
+	[SCORE_TRUTH]  = {"truth",  SCORE(truth),  155},
+};
+
+/*----------------------------------------------------------------------
+ * 登録した楽譜を取得する（戻り値 0: 登録なし）
+ *----------------------------------------------------------------------*/
+const Score_t *scoreGet(int id) {
+	if (id < 0 || id >= SCORE_NUM) {
+		return 0;
+	}
+
+	return &scoreTable[id];
+}
+
+/*----------------------------------------------------------------------
+ * 登録した楽譜を演奏する
+ * id   : 楽譜の番号（SCORE_DOREMI ～ SCORE_TRUTH）
+ * tempo: 演奏する速さ（0: 登録したテンポ）
+ * loop : 0 = 繰り返し再生なし、0以外: loop[msec]後に再生を繰り返す
+ * 戻り値 0: 成功、-1: 登録なし
+ *----------------------------------------------------------------------*/
+int scorePlay(int id, int tempo, int loop) {
+	const Score_t *s = scoreGet(id);
+
+	if (!s) {
+		return -1;
+	}
+
+	playPacked(s->score, s->num, tempo ? tempo : s->tempo, loop);
+	return 0;
+}
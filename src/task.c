@@ -0,0 +1,202 @@
+/*===============================================================================
+ * Name        : task.c
+ * Author      : $(author)
+ * Version     :
+ * CPU type    : ARM Cortex-M3 LPC1343
+ * Copyright   : $(copyright)
+ * Description : Cooperative run-to-completion task scheduler
+ *===============================================================================*/
+// Cortex Microcontroller Software Interface Standard
+#ifdef __USE_CMSIS
+#include "LPC13xx.h"
+#endif
+
+#include "type.h"
+#include "timer.h"
+#include "work.h"
+#include "atomic.h"
+#include "task.h"
+
+/*----------------------------------------------------------------------
+ * タスク管理テーブル
+ *----------------------------------------------------------------------*/
+typedef struct {
+	void (*func)(void);			// タスクの関数
+	unsigned long period;		// 起動周期[μsec]（0: TASK_EVENT）
+	unsigned long long next;	// 次の起動予定時刻[μsec]
+	unsigned char priority;		// 優先度（0が最優先）
+	unsigned char active;		// 登録済み
+	unsigned char suspend;		// 起動を停止中
+	Atomic_t signal;			// taskSignal() による起動要求の回数
+	TaskStat_t stat;			// 実行統計
+} Task_t;
+
+static Task_t taskTable[TASK_MAX];
+static unsigned char taskNum = 0;			// 登録済みのタスク数
+static unsigned long long taskBase = 0;	// 周期起動の基準時刻[μsec]（0: taskRun() 前）
+
+/*----------------------------------------------------------------------
+ * 周期起動の予定時刻を TASK_TICK の刻みに揃える
+ * - 刻みごとのタイマー割込みと同時に起動できるようにする
+ *----------------------------------------------------------------------*/
+static unsigned long long alignTick(unsigned long long t) {
+	unsigned long long tick = TASK_TICK * 1000;
+
+	return taskBase + ((t - taskBase + tick - 1) / tick) * tick;
+}
+
+/*----------------------------------------------------------------------
+ * タスクの登録
+ * - period[msec]周期で起動する（TASK_EVENT の場合は taskSignal() でのみ起動する）
+ * - 戻り値はタスクの識別子（登録できない場合は -1）
+ *----------------------------------------------------------------------*/
+int taskCreate(void (*f)(void), unsigned long period, int priority) {
+	Task_t *t;
+
+	if (!f || taskNum >= TASK_MAX) {
+		return -1;
+	}
+
+	t = &taskTable[taskNum];
+	t->func     = f;
+	t->period   = period * 1000;
+	t->priority = MAX(0, MIN(priority, 0xFF));
+	t->suspend  = FALSE;
+	t->signal   = 0;
+
+	// taskRun() の開始後に登録された場合は、次の刻みから起動する
+	if (taskBase) {
+		t->next = alignTick(timerMicros() + t->period);
+	}
+
+	t->active = TRUE;
+
+	return taskNum++;
+}
+
+/*----------------------------------------------------------------------
+ * タスクの起動要求（割込みハンドラからも呼び出せる）
+ *----------------------------------------------------------------------*/
+void taskSignal(int id) {
+	if (id >= 0 && id < taskNum) {
+		atomicInc(&taskTable[id].signal);
+	}
+}
+
+/*----------------------------------------------------------------------
+ * タスクの起動停止、再開
+ *----------------------------------------------------------------------*/
+void taskSuspend(int id) {
+	if (id >= 0 && id < taskNum) {
+		taskTable[id].suspend = TRUE;
+	}
+}
+
+void taskResume(int id) {
+	if (id >= 0 && id < taskNum && taskTable[id].suspend) {
+		if (taskBase) {
+			taskTable[id].next = alignTick(timerMicros() + taskTable[id].period);
+		}
+		taskTable[id].suspend = FALSE;
+	}
+}
+
+/*----------------------------------------------------------------------
+ * 実行可能なタスクのうち、最も優先度の高いタスクを選ぶ（-1: なし）
+ *----------------------------------------------------------------------*/
+static int pick(unsigned long long now) {
+	int id, found = -1;
+
+	for (id = 0; id < taskNum; id++) {
+		Task_t *t = &taskTable[id];
+
+		if (!t->active || t->suspend) {
+			continue;
+		}
+
+		if (t->signal || (t->period && now >= t->next)) {
+			if (found < 0 || t->priority < taskTable[found].priority) {
+				found = id;
+			}
+		}
+	}
+
+	return found;
+}
+
+/*----------------------------------------------------------------------
+ * タスクを実行し、実行統計を更新する
+ *----------------------------------------------------------------------*/
+static void run(int id, unsigned long long now) {
+	Task_t *t = &taskTable[id];
+	unsigned long cycles;
+
+	// 起動要求を優先して消化する
+	// 周期起動の場合は、次の起動予定時刻を求める
+	if (!atomicDecIfPositive(&t->signal)) {
+		t->stat.maxLate = MAX(t->stat.maxLate, (unsigned long)(now - t->next));
+		t->next += t->period;
+
+		// 周期に間に合わなかった起動は省略する
+		if (now >= t->next) {
+			unsigned long skip = (unsigned long)((now - t->next) / t->period) + 1;
+			t->stat.overruns += skip;
+			t->next += (unsigned long long)skip * t->period;
+		}
+	}
+
+	cycles = timerCycles();
+	t->func();
+	cycles = timerCycles() - cycles;
+
+	t->stat.runs++;
+	t->stat.cycles += cycles;
+	t->stat.maxCycles = MAX(t->stat.maxCycles, cycles);
+}
+
+/*----------------------------------------------------------------------
+ * タスクの実行（戻らない）
+ * - 実行可能なタスクがなければ、割込みから workPost() された関数を実行する
+ * - それもなければ、次の刻みか割込みまで WFI で待機する
+ *----------------------------------------------------------------------*/
+void taskRun(void) {
+	int id;
+
+	// 周期起動の基準時刻を決め、刻みごとにタイマー割込みで WFI から復帰させる
+	taskBase = timerMicros();
+	timerStart(TASK_TICK, TASK_TICK, 0, TIMER_IN_ISR);
+
+	for (id = 0; id < taskNum; id++) {
+		taskTable[id].next = taskBase + taskTable[id].period;
+	}
+
+	while (1) {
+		unsigned long long now = timerMicros();
+
+		// 選択から WFI までの間の taskSignal() を取りこぼさないよう、割込み禁止で判定する
+		// Note: PRIMASK がセットされていても、割込みの発生で WFI から復帰する
+		__disable_irq();
+		id = pick(now);
+		if (id < 0 && !workPending()) {
+			__WFI();
+		}
+		__enable_irq();
+
+		if (id >= 0) {
+			run(id, now);
+		} else {
+			workRun();
+		}
+	}
+}
+
+/*----------------------------------------------------------------------
+ * タスクの実行統計を取得する
+ *----------------------------------------------------------------------*/
+void taskStat(int id, TaskStat_t *stat) {
+	if (id >= 0 && id < taskNum && stat) {
+		__disable_irq();
+		*stat = taskTable[id].stat;
+		__enable_irq();
+	}
+}
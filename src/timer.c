@@ -13,36 +13,143 @@
 
 #include "type.h"
 #include "clk.h"
+#include "atomic.h"
 #include "timer.h"
 
 /*----------------------------------------------------------------------
- * 1msecごとのカウンタ
+ * Timer debug configuration
  *----------------------------------------------------------------------*/
-volatile static unsigned char cancelTimer = 0;
+#define	TIMER_DEBUG		0
+#if		TIMER_DEBUG
+#include <stdio.h>
+#include "sci.h"
+#else
+#define	sciPrintf(...)
+#endif
+
+/*----------------------------------------------------------------------
+ * カウンタ／タイマーの資源管理
+ * - 確保したモジュール名を、カウンタとチャネル（TMR_MR0 ～ TMR_COUNTER の各ビット）ごとに記録する
+ *----------------------------------------------------------------------*/
+#define	TMR_NUM		4	// CT16B0, CT16B1, CT32B0, CT32B1
+#define	TMR_BITS	8	// 資源のビット数
+
+static LPC_TMR_TypeDef *const tmrTable[TMR_NUM] = {
+	LPC_TMR16B0, LPC_TMR16B1, LPC_TMR32B0, LPC_TMR32B1,
+};
+static const char *tmrOwner[TMR_NUM][TMR_BITS];
+static volatile int tmrConflict = 0;	// 競合した回数
 
 /*----------------------------------------------------------------------
- * 指定時間後に起動する関数
+ * 待機のキャンセル
+ *----------------------------------------------------------------------*/
+static AtomicFlag_t cancelTimer = 0;
+
+/*----------------------------------------------------------------------
+ * 64ビット時刻の上位を拡張するカウンタ
+ * - TC（1[μsec]ごと）が 0x80000000 と 0 を通過するたびに MR3 の一致割込みで加算する
+ * - 偶奇が TC の最上位ビットと一致し、上位32ビットは timerEpoch >> 1 となる
+ *----------------------------------------------------------------------*/
+static volatile unsigned long timerEpoch = 0;
+
+/*----------------------------------------------------------------------
+ * 指定時間後に起動する関数（timerWakeup(), MR0）
  *----------------------------------------------------------------------*/
 static void (*timerIRQHandler)(void) = 0;
 
+/*----------------------------------------------------------------------
+ * ソフトウェアタイマー（timerStart(), MR1）
+ * - 満了時刻と周期は TC の単位（1[μsec]）で保持する
+ * - 満了時刻の昇順に並べた連結リストの先頭だけを MR1 に設定する
+ * - 割込みハンドラでは先頭を取り出すだけで満了を判定できる
+ *----------------------------------------------------------------------*/
+typedef struct {
+	unsigned long deadline;		// 満了時刻（TC）
+	unsigned long period;		// 周期[μsec]（0: ワンショット）
+	void (*func)(void);			// 満了時に実行する関数
+	unsigned char mode;			// TIMER_IN_ISR, TIMER_DEFERRED
+	unsigned char active;		// 動作中
+	volatile unsigned char pending;	// 満了済みで未実行の回数（TIMER_DEFERRED）
+	signed char next;			// 次に満了するスロット（-1: 終端）
+} TimerSlot_t;
+
+static TimerSlot_t timerSlot[TIMER_SLOTS];
+static volatile signed char timerHead = -1;	// 最初に満了するスロット（-1: なし）
+
+/*----------------------------------------------------------------------
+ * DWT (Data Watchpoint and Trace) のサイクルカウンタ
+ * ARMv7-M Architecture Reference Manual C1.8 Data Watchpoint and Trace unit
+ *----------------------------------------------------------------------*/
+#define	DWT_CTRL	(*(volatile unsigned long *)0xE0001000)	// Control Register
+#define	DWT_CYCCNT	(*(volatile unsigned long *)0xE0001004)	// Cycle Count Register
+#define	DEMCR		(*(volatile unsigned long *)0xE000EDFC)	// Debug Exception and Monitor Control Register
+
+#define	CYCLE_UNKNOWN	0	// 未確認
+#define	CYCLE_DWT		1	// DWT_CYCCNT を使用する
+#define	CYCLE_TIMER		2	// DWT がないため、タイマー（TC）で代替する
+
+static unsigned char cycleSource = CYCLE_UNKNOWN;
+static unsigned long cycleClock  = 0;	// CPUクロック[Hz]（timerInit() で更新）
+
+/*----------------------------------------------------------------------
+ * 1[msec]当たりのカウント数
+ * - メインクロックが TIMER_FREQ 未満（WDT oscillator）の場合は PCLK のまま数えるため、
+ *   timerWakeup() の時間はこの値で換算する（その間の timerMicros() は正確ではない）
+ *----------------------------------------------------------------------*/
+static unsigned long timerTicksPerMsec = TIMER_FREQ / 1000;
+
+static unsigned long msecToTicks(unsigned long msec) {
+	return msec * timerTicksPerMsec;
+}
+
 /*----------------------------------------------------------------------
  * タイマCT32B1の初期化
+ * - メインクロックの切替時にも呼び出され、その場合はプリスケールだけを更新する
  *----------------------------------------------------------------------*/
 void timerInit(void) {
+	unsigned long clock = clkGetMainClock();
+	unsigned long prescale = MAX(clock / TIMER_FREQ, 1);
+
+	timerTicksPerMsec = MAX(clock / prescale / 1000, 1);
+	cycleClock = clock;
+
+	// 16.8.4 PreScale Register (TMR32B1PR)
+	// Bit31:0(PR): Maximum value for the PC
+	// Note: LPC_SYSCON->SYSAHBCLKDIV = 1 --> PCLK = 72MHz
+	// 動作中の場合は時刻を維持する
+	if ((LPC_SYSCON->SYSAHBCLKCTRL & (1<<10)) && (LPC_TMR32B1->TCR & 1)) {
+		LPC_TMR32B1->PR = prescale - 1;
+		return;
+	}
+
+	// カウンタと MR0（timerWakeup）、MR1（timerStart）、MR3（64ビット時刻）を使用する
+	timerClaim(TMR_32B1, TMR_COUNTER | TMR_MR0 | TMR_MR1 | TMR_MR3, "timer");
+
 	/*-----------------------------------------
 	 * 16.2 Basic configuration
 	 *-----------------------------------------*/
-	// 16.8.2 Timer Control Register (TMR32B1TCR)
-	LPC_TMR32B1->TCR = 0; // Bit0(CEN) : When zero, the counters are disabled
-
 	// 3.5.18 System AHB clock control register (SYSAHBCLKCTRL)
 	// Bit10: Enables clock for 32-bit counter/timer 1
 	LPC_SYSCON->SYSAHBCLKCTRL |= (1<<10);
 
+	// 16.8.2 Timer Control Register (TMR32B1TCR)
+	LPC_TMR32B1->TCR = 0; // Bit0(CEN) : When zero, the counters are disabled
+
 	// 16.8.4 PreScale Register (TMR32B1PR)
-	// Bit31:0(PR): Maximum value for the PC
-	// Note: LPC_SYSCON->SYSAHBCLKDIV = 1 --> PCLK = 72MHz
-	LPC_TMR32B1->PR = clkGetMainClock() / 1000 - 1; //TIMER_PRE_SCALE - 1;
+	LPC_TMR32B1->PR = prescale - 1; // 1[MHz]
+
+	// 16.8.6 Match Control Register (TMR32B1MCR)
+	// 16.8.7 Match Registers (TMR32B1MR3)
+	// Bit 9(MR3I): TC の半周期ごとに割り込み、64ビット時刻の上位を拡張する
+	timerEpoch = 0;
+	LPC_TMR32B1->MR3 = 0x80000000;
+	LPC_TMR32B1->IR  = (1<<3);
+	LPC_TMR32B1->MCR = (1<<9);
+
+	// 6.6.2 Interrupt Set-Enable Register 1 (ISER1)
+	// Bit 12 (ISE_CT32B1): Enable timer CT32B1 interrupt
+	NVIC_ClearPendingIRQ(TIMER_32_1_IRQn);
+	NVIC_EnableIRQ(TIMER_32_1_IRQn);
 
 	// 16.8.2 Timer Control Register (TMR32B1TCR)
 	LPC_TMR32B1->TCR = 2; // Bit1(CRES): TC and PC are synchronously reset on next positive edge of PCLK
@@ -50,11 +157,329 @@ void timerInit(void) {
 }
 
 /*----------------------------------------------------------------------
- * タイマーカウンタの読み出し
+ * カウンタ／タイマーの資源の確保
+ * - resources: TMR_MR0 ～ TMR_MR3, TMR_CAP0, TMR_COUNTER の論理和
+ * - 同じモジュールによる再度の確保は成功する
+ * - 1つでも他のモジュールが確保済みなら何も確保せず、競合を記録して -1 を返す
+ *----------------------------------------------------------------------*/
+int timerClaim(int timer, unsigned char resources, const char *owner) {
+	unsigned long primask;
+	int i;
+
+	if (timer < 0 || timer >= TMR_NUM || !owner) {
+		return -1;
+	}
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+
+	for (i = 0; i < TMR_BITS; i++) {
+		if ((resources & (1 << i)) && tmrOwner[timer][i] && tmrOwner[timer][i] != owner) {
+			tmrConflict++;
+			__set_PRIMASK(primask);
+
+			sciPrintf("timerClaim: timer %d bit %d of %s is owned by %s\r\n",
+				timer, i, owner, tmrOwner[timer][i]);
+			return -1;
+		}
+	}
+
+	for (i = 0; i < TMR_BITS; i++) {
+		if (resources & (1 << i)) {
+			tmrOwner[timer][i] = owner;
+		}
+	}
+
+	__set_PRIMASK(primask);
+	return 0;
+}
+
+/*----------------------------------------------------------------------
+ * カウンタ／タイマーの資源の解放（owner が確保した資源のみ）
+ *----------------------------------------------------------------------*/
+void timerRelease(int timer, unsigned char resources, const char *owner) {
+	unsigned long primask;
+	int i;
+
+	if (timer < 0 || timer >= TMR_NUM) {
+		return;
+	}
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+
+	for (i = 0; i < TMR_BITS; i++) {
+		if ((resources & (1 << i)) && tmrOwner[timer][i] == owner) {
+			tmrOwner[timer][i] = 0;
+		}
+	}
+
+	__set_PRIMASK(primask);
+}
+
+/*----------------------------------------------------------------------
+ * キャプチャ入力の開始（戻り値 0: 成功、-1: タイマー停止中または CAP0 の競合）
+ * - edge: TIMER_CAP_RISING, TIMER_CAP_FALLING の論理和
+ * - f: 取り込んだ TC の値を受け取る関数（割込みハンドラから呼び出される）
+ *----------------------------------------------------------------------*/
+static const char captureOwner[] = "capture";
+static void (*captureHandler)(unsigned long tc) = 0;
+static unsigned long captureIocon;	// 開始前の IOCON_R_PIO1_0（AD1 の設定など）
+
+int timerCaptureStart(int edge, void (*f)(unsigned long tc)) {
+	// 16.8.2 Timer Control Register (TMR32B1TCR)
+	// Bit0(CEN) : TC and PC are enabled for counting
+	if (!(LPC_TMR32B1->TCR & 1) || !(edge & 3) || !f) {
+		return -1;
+	}
+
+	if (timerClaim(TMR_32B1, TMR_CAP0, captureOwner) < 0) {
+		return -1;
+	}
+
+	// 7.4.29 IOCON_R_PIO1_0
+	// Bit 2:0 (FUNC)  : 011(Selects function CT32B1_CAP0)
+	// Bit   7 (ADMODE): 1(Digital functional mode)
+	// 停止時に元の機能（右センサの AD1 など）に戻すため、設定を保存する
+	captureIocon = LPC_IOCON->R_PIO1_0;
+	LPC_IOCON->R_PIO1_0 = (LPC_IOCON->R_PIO1_0 & ~0x07) | 0x03 | (1<<7);
+
+	captureHandler = f;
+
+	// 16.8.8 Capture Control Register (TMR32B1CCR)
+	// Bit 0 (CAP0RE): Capture on CT32B1_CAP0 rising edge
+	// Bit 1 (CAP0FE): Capture on CT32B1_CAP0 falling edge
+	// Bit 2 (CAP0I) : Interrupt on CT32B1_CAP0 event
+	LPC_TMR32B1->IR  = (1<<4);
+	LPC_TMR32B1->CCR = (edge & 3) | (1<<2);
+
+	return 0;
+}
+
+/*----------------------------------------------------------------------
+ * キャプチャ入力の停止
+ * - R_PIO1_0 を timerCaptureStart() 前の設定に戻す
+ *----------------------------------------------------------------------*/
+void timerCaptureStop(void) {
+	if (!captureHandler) {
+		return;
+	}
+
+	LPC_TMR32B1->CCR = 0;
+	captureHandler = 0;
+
+	// 7.4.29 IOCON_R_PIO1_0
+	LPC_IOCON->R_PIO1_0 = captureIocon;
+
+	timerRelease(TMR_32B1, TMR_CAP0, captureOwner);
+}
+
+/*----------------------------------------------------------------------
+ * 資源を確保しているモジュール名（0: 未確保）
+ * - resource: TMR_MR0 ～ TMR_COUNTER のいずれか1つ
+ *----------------------------------------------------------------------*/
+const char *timerOwner(int timer, unsigned char resource) {
+	int i;
+
+	if (timer >= 0 && timer < TMR_NUM) {
+		for (i = 0; i < TMR_BITS; i++) {
+			if (resource & (1 << i)) {
+				return tmrOwner[timer][i];
+			}
+		}
+	}
+
+	return 0;
+}
+
+/*----------------------------------------------------------------------
+ * timerClaim() で競合した回数（初期化後に 0 であることを確認する）
+ *----------------------------------------------------------------------*/
+int timerConflicts(void) {
+	return tmrConflict;
+}
+
+/*----------------------------------------------------------------------
+ * マッチチャネル ch の動作（TMR_MCR_I, TMR_MCR_R, TMR_MCR_S）の設定
+ * - MCR の他のチャネルのビットは変更しないため、カウンタを共有するモジュールが
+ *   割込みハンドラとスレッドから同時に設定しても干渉しない
+ *----------------------------------------------------------------------*/
+void timerMatchControl(int timer, int ch, unsigned char mcr) {
+	LPC_TMR_TypeDef *t;
+	unsigned long primask;
+
+	if (timer < 0 || timer >= TMR_NUM || ch < 0 || ch > 3) {
+		return;
+	}
+	t = tmrTable[timer];
+
+	// 15.8.6 Match Control Register (TMR16B0MCR, TMR16B1MCR)
+	// 16.8.6 Match Control Register (TMR32B0MCR, TMR32B1MCR)
+	// Bit 3n+2:3n (MRnS, MRnR, MRnI): Stop, Reset, Interrupt on MRn
+	primask = __get_PRIMASK();
+	__disable_irq();
+	t->MCR = (t->MCR & ~(7UL << (ch * 3))) | ((unsigned long)(mcr & 7) << (ch * 3));
+	__set_PRIMASK(primask);
+}
+
+/*----------------------------------------------------------------------
+ * 64ビットの時刻[μsec]の読み出し（約58万年で桁あふれ）
+ * - 割込み禁止や MR3 割込みの遅れがあっても、単調増加する時刻を返す
+ *----------------------------------------------------------------------*/
+unsigned long long timerMicros(void) {
+	unsigned long e, t;
+
+	// 16.8.3 Timer Counter (TMR32B1TC)
+	// 読み出し中に上位が更新された場合は読み直す
+	do {
+		e = timerEpoch;
+		t = LPC_TMR32B1->TC;
+	} while (e != timerEpoch);
+
+	// TC の最上位ビットと偶奇が異なる場合は、MR3 の割込みが未処理
+	if ((e & 1) != (t >> 31)) {
+		e++;
+	}
+
+	return ((unsigned long long)(e >> 1) << 32) | t;
+}
+
+/*----------------------------------------------------------------------
+ * タイマーが動作中か調べる（timerInit() の後は TRUE）
+ * - FALSE の間は timerStart() などのソフトウェアタイマーは満了しない
+ *----------------------------------------------------------------------*/
+int timerRunning(void) {
+	// 16.8.2 Timer Control Register (TMR32B1TCR)
+	// Bit0(CEN) : TC and PC are enabled for counting
+	return (LPC_TMR32B1->TCR & 1) ? TRUE : FALSE;
+}
+
+/*----------------------------------------------------------------------
+ * 時刻[msec]の読み出し（約49日で桁あふれ、比較には TIMER_BEFORE() を使う）
+ * - 64ビットの除算（__aeabi_uldivmod）を避け、半周期の数 h と半周期内の時刻 t から
+ *   h × 2^31 = h × 2147483 × 1000 + h × 648 を用いて32ビットの乗算と除算で求める
+ * - h × 648 + t は約226年まで32ビットに収まり、結果は 2^32 を法として正確
+ *----------------------------------------------------------------------*/
+#define	TIMER_HALF_MS	2147483UL	// 2^31[μsec] ÷ 1000 の商
+#define	TIMER_HALF_US	648UL		// 2^31[μsec] ÷ 1000 の余り
+
+unsigned long timerRead(void) {
+	unsigned long e, t;
+
+	// 16.8.3 Timer Counter (TMR32B1TC)
+	do {
+		e = timerEpoch;
+		t = LPC_TMR32B1->TC;
+	} while (e != timerEpoch);
+
+	// TC の最上位ビットと偶奇が異なる場合は、MR3 の割込みが未処理
+	if ((e & 1) != (t >> 31)) {
+		e++;
+	}
+	t &= 0x7FFFFFFF;
+
+	return e * TIMER_HALF_MS + (e * TIMER_HALF_US + t) / 1000;
+}
+
+/*----------------------------------------------------------------------
+ * 現在から usec[μsec]後の時刻、時刻の経過判定
+ *----------------------------------------------------------------------*/
+unsigned long long timerDeadline(unsigned long long usec) {
+	return timerMicros() + usec;
+}
+
+int timerExpired(unsigned long long deadline) {
+	return timerMicros() >= deadline;
+}
+
+/*----------------------------------------------------------------------
+ * サイクルカウンタの初期化
+ * - DWT がなければ（NOCYCCNT = 1）、タイマー（TC）の時刻から換算する
+ * - 戻り値は DWT_CYCCNT が使用できれば TRUE
+ *----------------------------------------------------------------------*/
+int timerCycleInit(void) {
+	if (!cycleClock) {
+		cycleClock = clkGetMainClock();
+	}
+
+	// Bit 24 (TRCENA): Global enable for all DWT and ITM features
+	DEMCR |= (1<<24);
+
+	// Bit 25 (NOCYCCNT): 1 = cycle counter not supported
+	if (DWT_CTRL & (1<<25)) {
+		cycleSource = CYCLE_TIMER;
+		return FALSE;
+	}
+
+	// Bit 0 (CYCCNTENA): Enable the CYCCNT counter
+	DWT_CYCCNT = 0;
+	DWT_CTRL |= (1<<0);
+
+	// 書き込めない実装（デバッガ接続時のみ有効など）の場合に備えて確認する
+	cycleSource = (DWT_CTRL & (1<<0)) ? CYCLE_DWT : CYCLE_TIMER;
+
+	return cycleSource == CYCLE_DWT;
+}
+
+/*----------------------------------------------------------------------
+ * サイクル数の読み出し（32ビットで桁あふれ、差分で経過サイクル数を求める）
+ *----------------------------------------------------------------------*/
+unsigned long timerCycles(void) {
+	if (cycleSource == CYCLE_UNKNOWN) {
+		timerCycleInit();
+	}
+
+	if (cycleSource == CYCLE_DWT) {
+		return DWT_CYCCNT;
+	}
+
+	// タイマー（1[μsec]）の時刻をサイクル数に換算する
+	return (unsigned long)(timerMicros() * (cycleClock / 1000000));
+}
+
+/*----------------------------------------------------------------------
+ * サイクル数を[μsec]に換算する
  *----------------------------------------------------------------------*/
-inline unsigned long timerRead(void) {
-	// 16.8.3 Timer Counter (TMR32B0TC)
-	return LPC_TMR32B1->TC;
+unsigned long timerCyclesToMicros(unsigned long cycles) {
+	return (unsigned long)(((unsigned long long)cycles * 1000000) / MAX(cycleClock, 1));
+}
+
+/*----------------------------------------------------------------------
+ * 指定時間[μsec]の待機（最長でも 2^32 サイクル、72[MHz]で約59秒）
+ * - DWT があればサイクル単位、なければタイマー（TC）、
+ *   timerInit() もされていなければ空ループで待機する
+ *----------------------------------------------------------------------*/
+#define	SOFTWARE_WAIT	2000UL // ソフトウェアタイマーの1msec当たりの空ループ回数
+
+void timerDelayUs(unsigned long usec) {
+	unsigned long start, cycles;
+
+	if (cycleSource == CYCLE_UNKNOWN) {
+		timerCycleInit();
+	}
+
+	// DWT_CYCCNT
+	if (cycleSource == CYCLE_DWT) {
+		start  = DWT_CYCCNT;
+		cycles = (unsigned long)(((unsigned long long)usec * cycleClock) / 1000000);
+		while (DWT_CYCCNT - start < cycles);
+	}
+
+	// 16.8.2 Timer Control Register (TMR32B1TCR)
+	// Bit0(CEN) : TC and PC are enabled for counting
+	else if (LPC_TMR32B1->TCR & 1) {
+		unsigned long long deadline = timerDeadline(usec + 1);	// 端数分を切り上げる
+		while (!timerExpired(deadline));
+	}
+
+	// Software timer
+	else {
+		// Disable optimization and force the counter to be placed into memory
+		volatile unsigned long i;
+		for (i = (usec * SOFTWARE_WAIT) / 1000; i > 0; i--) {
+			__NOP();
+		}
+	}
 }
 
 /*----------------------------------------------------------------------
@@ -66,7 +491,8 @@ void timerWakeup(unsigned long msec, void (*f)(void)) {
 
 	// 16.8.6 Match Control Register (TMR32B1MCR)
 	// Bit 0(MR0I): Enable interrupt when MR0 matches TC
-	LPC_TMR32B1->MCR = (1<<0);
+	// Note: MR1 はソフトウェアタイマーが使用するため、MR0 のビットだけを変更する
+	timerMatchControl(TMR_32B1, 0, TMR_MCR_I);
 
 	// Reset the interrupt flag for MR0INT～MR3INT
 	// 16.8.1 Interrupt Register (TMR32B1IR)
@@ -76,7 +502,7 @@ void timerWakeup(unsigned long msec, void (*f)(void)) {
 	// 16.8.7 Match Registers (TMR32B1MRn)
 	// Bit 31:0 (MATCH): Timer counter match value
 	// Note: Initial value is required before timer start
-	LPC_TMR32B1->MR0 = timerRead() + MAX(1, msec);
+	LPC_TMR32B1->MR0 = LPC_TMR32B1->TC + msecToTicks(MAX(1, msec));
 
 	// Configure CT32B1_MAT0 to go from High to Low for Deep Sleep mode
 	// 16.8.10 External Match Register (TMR32B1EMR)
@@ -91,52 +517,339 @@ void timerWakeup(unsigned long msec, void (*f)(void)) {
 	NVIC_EnableIRQ(TIMER_32_1_IRQn); // Nested Vectored Interrupt Controller (NVIC)
 }
 
+/*----------------------------------------------------------------------
+ * スロットを満了時刻の順にリストへ挿入する（同時刻の場合は後ろに並べる）
+ * - 割込み禁止で呼び出すこと
+ *----------------------------------------------------------------------*/
+static void insert(int id) {
+	volatile signed char *p = &timerHead;
+
+	while (*p >= 0 && !TIMER_BEFORE(timerSlot[id].deadline, timerSlot[(int)*p].deadline)) {
+		p = &timerSlot[(int)*p].next;
+	}
+
+	timerSlot[id].next = *p;
+	*p = id;
+}
+
+/*----------------------------------------------------------------------
+ * スロットをリストから外す
+ * - 割込み禁止で呼び出すこと
+ *----------------------------------------------------------------------*/
+static void unlink(int id) {
+	volatile signed char *p = &timerHead;
+
+	while (*p >= 0) {
+		if (*p == id) {
+			*p = timerSlot[id].next;
+			break;
+		}
+		p = &timerSlot[(int)*p].next;
+	}
+}
+
+/*----------------------------------------------------------------------
+ * リスト先頭の満了時刻を MR1 に設定する
+ * - 割込み禁止で呼び出すこと
+ *----------------------------------------------------------------------*/
+static void arm(void) {
+	// 16.8.6 Match Control Register (TMR32B1MCR)
+	// Bit 3(MR1I): Enable interrupt when MR1 matches TC
+	if (timerHead < 0) {
+		timerMatchControl(TMR_32B1, 1, 0);
+		return;
+	}
+
+	// 16.8.7 Match Registers (TMR32B1MR1)
+	LPC_TMR32B1->MR1 = timerSlot[(int)timerHead].deadline;
+	timerMatchControl(TMR_32B1, 1, TMR_MCR_I);
+
+	// 設定中に満了時刻を過ぎた場合は、一致を待たずに割り込む
+	if (!TIMER_BEFORE(LPC_TMR32B1->TC, timerSlot[(int)timerHead].deadline)) {
+		NVIC_SetPendingIRQ(TIMER_32_1_IRQn);
+	}
+}
+
+/*----------------------------------------------------------------------
+ * 満了したスロットを処理する
+ * - 先頭を取り出すだけなので、ワンショットの満了は O(1) で処理される
+ * - 周期タイマーは次の満了時刻で挿入し直す（スロット数 TIMER_SLOTS 以下の探索）
+ *----------------------------------------------------------------------*/
+static void expire(void) {
+	int id;
+
+	while ((id = timerHead) >= 0 && !TIMER_BEFORE(LPC_TMR32B1->TC, timerSlot[id].deadline)) {
+		TimerSlot_t *t = &timerSlot[id];
+
+		timerHead = t->next;
+
+		if (t->period) {
+			t->deadline += t->period;
+			insert(id);
+		} else {
+			t->active = FALSE;
+		}
+
+		if (t->mode == TIMER_DEFERRED) {
+			t->pending++;	// timerDispatch() で実行する
+		} else if (t->func) {
+			t->func();		// 割込みハンドラ内で実行する
+		}
+	}
+
+	arm();
+}
+
+/*----------------------------------------------------------------------
+ * ソフトウェアタイマーの開始
+ * - msec[msec]後に満了し、period が 0 でなければ以後 period[msec]周期で満了する
+ * - mode
+ *	TIMER_IN_ISR:   満了時に割込みハンドラ内で f を実行する
+ *	TIMER_DEFERRED: 満了時は記録だけ行い、timerDispatch() で f を実行する
+ * - 戻り値はタイマーの識別子（空きスロットがない場合は -1）
+ *----------------------------------------------------------------------*/
+static int startTicks(unsigned long ticks, unsigned long period, void (*f)(void), int mode);
+
+int timerStart(unsigned long msec, unsigned long period, void (*f)(void), int mode) {
+	return startTicks(msecToTicks(MAX(1, msec)), msecToTicks(period), f, mode);
+}
+
+/*----------------------------------------------------------------------
+ * ソフトウェアタイマーの開始（満了までの時間と周期は TC のカウント数で指定する）
+ *----------------------------------------------------------------------*/
+static int startTicks(unsigned long ticks, unsigned long period, void (*f)(void), int mode) {
+	int id;
+	unsigned long primask;
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+
+	// 空きスロットを探す
+	for (id = 0; id < TIMER_SLOTS; id++) {
+		if (!timerSlot[id].active && !timerSlot[id].pending) {
+			break;
+		}
+	}
+
+	if (id < TIMER_SLOTS) {
+		TimerSlot_t *t = &timerSlot[id];
+
+		t->deadline = LPC_TMR32B1->TC + MAX(1, ticks);
+		t->period   = period;
+		t->func     = f;
+		t->mode     = mode;
+		t->active   = TRUE;
+		t->pending  = 0;
+
+		insert(id);
+		arm();
+	} else {
+		id = -1;
+	}
+
+	__set_PRIMASK(primask);
+
+	// 6.6.2 Interrupt Set-Enable Register 1 (ISER1)
+	// Bit 12 (ISE_CT32B1): Enable timer CT32B1 interrupt
+	if (id >= 0) {
+		NVIC_EnableIRQ(TIMER_32_1_IRQn);
+	}
+
+	return id;
+}
+
+/*----------------------------------------------------------------------
+ * ソフトウェアタイマーの停止（未実行の TIMER_DEFERRED も取り消す）
+ *----------------------------------------------------------------------*/
+void timerStop(int id) {
+	unsigned long primask;
+
+	if (id < 0 || id >= TIMER_SLOTS) {
+		return;
+	}
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+
+	if (timerSlot[id].active) {
+		unlink(id);
+		arm();
+	}
+	timerSlot[id].active  = FALSE;
+	timerSlot[id].pending = 0;
+
+	__set_PRIMASK(primask);
+}
+
+/*----------------------------------------------------------------------
+ * 満了した TIMER_DEFERRED のタイマーの関数を実行する
+ * - メイン処理から定期的に呼び出す
+ * - 戻り値は実行した関数の数
+ *----------------------------------------------------------------------*/
+int timerDispatch(void) {
+	int id, n = 0;
+
+	for (id = 0; id < TIMER_SLOTS; id++) {
+		while (timerSlot[id].pending) {
+			void (*f)(void);
+
+			__disable_irq();
+			f = timerSlot[id].func;
+			timerSlot[id].pending--;
+			__enable_irq();
+
+			if (f) {
+				f();
+				n++;
+			}
+		}
+	}
+
+	return n;
+}
+
 /*----------------------------------------------------------------------
  * タイマCT32B1 割り込みハンドラ
+ * - MR3: 64ビット時刻の上位を拡張する
+ * - MR0: timerWakeup() で登録された関数を1回だけ実行する
+ * - MR1: ソフトウェアタイマーの満了を処理する
  *----------------------------------------------------------------------*/
 void TIMER32_1_IRQHandler(void) {
 	uint32_t IR = LPC_TMR32B1->IR;
 
-	// 6.6.4 Interrupt Clear-Enable Register 1 register (ICER1)
-	// Bit12(ICE_CT32B1): Timer CT32B1 interrupt disable
-	NVIC_DisableIRQ(TIMER_32_1_IRQn); // Nested Vectored Interrupt Controller (NVIC)
-
 	// Reset the interrupt flag for MR0INT～MR3INT
 	// 16.8.1 Interrupt Register (TMR32B1IR)
 	// Note: Writing a zero has no effect.
 	LPC_TMR32B1->IR = IR; // Required
 
-	// 登録された関数を呼び出す
-	if (timerIRQHandler) {
-		timerIRQHandler();
+	// Bit 3 (MR3INT): TC の半周期ごとに64ビット時刻の上位を拡張する
+	if (IR & (1<<3)) {
+		timerEpoch++;
+		LPC_TMR32B1->MR3 ^= 0x80000000;
 	}
+
+	// Bit 0 (MR0INT): timerWakeup()
+	if (IR & (1<<0)) {
+		// 16.8.6 Match Control Register (TMR32B1MCR)
+		// Bit 0(MR0I): Disable interrupt when MR0 matches TC
+		timerMatchControl(TMR_32B1, 0, 0);
+
+		// 登録された関数を呼び出す
+		if (timerIRQHandler) {
+			timerIRQHandler();
+		}
+	}
+
+	// Bit 4 (CR0INT): キャプチャ入力
+	if ((IR & (1<<4)) && captureHandler) {
+		// 16.8.9 Capture Registers (TMR32B1CR0)
+		captureHandler(LPC_TMR32B1->CR0);
+	}
+
+	// Bit 1 (MR1INT): ソフトウェアタイマー
+	// Note: 満了時刻を過ぎて設定された場合は、一致なしで割り込むため IR によらず処理する
+	expire();
 }
 
 /*----------------------------------------------------------------------
- * 指定時間[msec]の待機
+ * 待機中のスリープ（1: WFI で割込みを待つ、0: 空ループで待つ）
+ * - 待機時間がアイドル時間となり、消費電力とバスの占有が減る
  *----------------------------------------------------------------------*/
-#define	SOFTWARE_WAIT	2000UL // ソフトウェアタイマーの1msec当たりの空ループ回数
+#define	TIMER_WAIT_WFI	1
+#define	TIMER_WAIT_MAX	60000	// 1回のタイマーで待機する最長時間[msec]
+
+static volatile unsigned char waitWakeup = FALSE;	// 待機用のタイマーが満了した
+
+static void wakeup(void) {
+	waitWakeup = TRUE;
+}
+
+/*----------------------------------------------------------------------
+ * 満了時刻までスリープする
+ * - 満了時刻にソフトウェアタイマーで割り込み、WFI から復帰させる
+ *   タイマーは TC のカウント（1[μsec]）単位で設定し、満了時刻を越えて眠らない
+ * - 他の割込みで復帰した場合も、満了かキャンセルでなければ再びスリープする
+ * - 呼び出し時の割込み禁止の状態（PRIMASK）を保つ
+ *   割込み禁止で呼び出された場合は wakeup() が実行されないため、
+ *   保留中の割込みで WFI からすぐに復帰し、満了時刻まで判定を繰り返す
+ *----------------------------------------------------------------------*/
+static void sleepUntil(unsigned long long deadline) {
+	int id = -1;
+	unsigned long primask = __get_PRIMASK();
+
+	// Sleep mode で待機する（Deep-sleep mode にしない）
+	// Bit 2 (SLEEPDEEP): 0 = Sleep mode
+	SCB->SCR &= ~(1<<2);
+
+	while (!atomicFlagTest(&cancelTimer) && !timerExpired(deadline)) {
+		if (id < 0 || waitWakeup) {
+			unsigned long long now = timerMicros();
+			unsigned long rest;
+
+			if (now >= deadline) {
+				break;
+			}
+			// timerMicros() は TC のカウント値なので、残り時間をそのまま設定する
+			rest = (unsigned long)MIN(deadline - now, TIMER_WAIT_MAX * 1000ULL);
+
+			waitWakeup = FALSE;
+			id = startTicks(rest, 0, wakeup, TIMER_IN_ISR);
+
+			// 空きスロットがなければ空ループで待機する
+			if (id < 0) {
+				continue;
+			}
+		}
 
-void __attribute__((optimize("O0"))) timerWait(unsigned long msec) {
+		// 判定から WFI までの間に wakeup() が実行されると、次の割込みまで眠り続ける
+		// そのため割込み禁止で判定し直してから WFI を実行する（taskRun() と同じ）
+		// Note: PRIMASK がセットされていても、割込みの発生で WFI から復帰する
+		__disable_irq();
+		if (!waitWakeup && !atomicFlagTest(&cancelTimer) && !timerExpired(deadline)) {
+			__WFI();
+		}
+		__set_PRIMASK(primask);
+	}
+
+	// 満了前に終了した場合はタイマーを止める（満了済みのスロットは再利用されているかもしれない）
+	__disable_irq();
+	if (id >= 0 && !waitWakeup) {
+		timerStop(id);
+	}
+	__set_PRIMASK(primask);
+}
+
+/*----------------------------------------------------------------------
+ * 指定時間[msec]の待機
+ *----------------------------------------------------------------------*/
+void timerWait(unsigned long msec) {
 	// キャンセルフラグを初期化する
-	cancelTimer = 0;
+	atomicFlagClear(&cancelTimer);
 
 	// 16.8.2 Timer Control Register (TMR32B1TCR)
 	// Bit0(CEN) : TC and PC are enabled for counting
 	if (LPC_TMR32B1->TCR & 1) {
-		unsigned long count = timerRead() + msec;
-		while (!cancelTimer && count > timerRead()) {
+		unsigned long long deadline = timerDeadline((unsigned long long)msec * 1000);
+
+#if	TIMER_WAIT_WFI
+		// 割込みハンドラ内では、タイマー割込みで復帰できない場合があるため空ループとする
+		// Interrupt Control and State Register (ICSR)
+		// Bit 8:0 (VECTACTIVE): 0 = Thread mode
+		if ((SCB->ICSR & 0x1FF) == 0) {
+			sleepUntil(deadline);
+			return;
+		}
+#endif
+
+		while (!atomicFlagTest(&cancelTimer) && !timerExpired(deadline)) {
 			__NOP();
 		}
 	}
 
-	// Software timer
-	// timerInit()が実行されなかった場合は空ループで代替する
+	// timerInit()が実行されなかった場合はサイクルカウンタで代替する
 	else {
-		// Disable optimization and force the counter to be placed into memory
-		volatile static unsigned long i;
-		for (i = msec * SOFTWARE_WAIT; !cancelTimer && i > 0; i--) {
-			__NOP();
+		while (!atomicFlagTest(&cancelTimer) && msec--) {
+			timerDelayUs(1000);
 		}
 	}
 }
@@ -145,5 +858,91 @@ void __attribute__((optimize("O0"))) timerWait(unsigned long msec) {
  * 待機のキャンセル
  *----------------------------------------------------------------------*/
 void timerWaitCancel(void) {
-	cancelTimer = 1;
+	atomicFlagSet(&cancelTimer);
+}
+
+#ifdef	EXAMPLE
+/*===============================================================================
+ * ソフトウェアタイマーの動作確認
+ * - 周期の異なる複数のタイマーを同時に動作させ、満了時刻からの遅れを計測する
+ * - 負荷として、メイン処理で割込み禁止区間と演奏（CT32B0割込み）を発生させる
+ * - 遅れの最大値が TIMER_LATE_LIMIT 以下なら LED1、超えたら LED2 を点灯する
+ *===============================================================================*/
+#include "type.h"
+#include "gpio.h"
+#include "play.h"
+#include "score.h"
+
+#define	TIMER_LATE_LIMIT	200	// 許容する遅れ[μsec]（割込みハンドラ内で実行）
+#define	TIMER_TASKS			4	// 同時に動作させるタイマーの数
+
+/*----------------------------------------------------------------------
+ * 計測対象のタイマー
+ *----------------------------------------------------------------------*/
+typedef struct {
+	unsigned long period;	// 周期[msec]
+	int mode;				// TIMER_IN_ISR, TIMER_DEFERRED
+	unsigned long long expected;	// 次の満了予定時刻[μsec]
+	unsigned long count;	// 満了回数
+	unsigned long late;		// 遅れの最大値[μsec]
+} TimerTask_t;
+
+static TimerTask_t timerTask[TIMER_TASKS] = {
+	{ 1, TIMER_IN_ISR  },
+	{ 3, TIMER_IN_ISR  },
+	{ 7, TIMER_DEFERRED},
+	{10, TIMER_DEFERRED},
+};
+
+static void measure(TimerTask_t *t) {
+	unsigned long late = (unsigned long)(timerMicros() - t->expected);
+
+	t->late = MAX(t->late, late);
+	t->expected += t->period * 1000;
+	t->count++;
+}
+
+static void task0(void) { measure(&timerTask[0]); }
+static void task1(void) { measure(&timerTask[1]); }
+static void task2(void) { measure(&timerTask[2]); }
+static void task3(void) { measure(&timerTask[3]); }
+
+void timerExample(void) {
+	int i;
+	unsigned long late;
+	unsigned long long t0;
+	void (*f[TIMER_TASKS])(void) = {task0, task1, task2, task3};
+
+	timerInit();
+	gpioInit();
+	playInit();
+
+	// 負荷: バックグラウンド演奏
+	scorePlay(SCORE_DOREMI, 180, -1);
+
+	// 開始時刻を基準に満了予定時刻を求める
+	for (i = 0; i < TIMER_TASKS; i++) {
+		t0 = timerMicros();
+		timerTask[i].expected = t0 + timerTask[i].period * 1000;
+		timerStart(timerTask[i].period, timerTask[i].period, f[i], timerTask[i].mode);
+	}
+
+	while (1) {
+		volatile int n;
+
+		// 負荷: 約0.1[msec]の割込み禁止区間
+		__disable_irq();
+		for (n = 0; n < 1000; n++);
+		__enable_irq();
+
+		// 遅延実行の関数を実行する
+		timerDispatch();
+
+		// 割込みハンドラ内で実行したタイマーの遅れを評価する
+		late = MAX(timerTask[0].late, timerTask[1].late);
+		ledOn(late <= TIMER_LATE_LIMIT ? LED1 : LED2);
+
+		sciPrintf("late: %ld %ld %ld %ld\r\n", timerTask[0].late, timerTask[1].late, timerTask[2].late, timerTask[3].late);
+	}
 }
+#endif // EXAMPLE
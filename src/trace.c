@@ -12,6 +12,9 @@
 #include "adc.h"
 #include "pwm.h"
 #include "play.h"
+#include "score.h"
+#include "task.h"
+#include "pt.h"
 #include "trace.h"
 
 #define	TRACE_DEBUG		0
@@ -29,6 +32,19 @@
  *----------------------------------------------------------------------*/
 #define	CALIBRATION_METHOD	1
 
+/*----------------------------------------------------------------------
+ * モーター指示の有効期間[msec]
+ * 制御ループやキャリブレーションが停止した場合、この時間でモーターを停止させる
+ *----------------------------------------------------------------------*/
+#define	CALIB_TIMEOUT		200		// キャリブレーション（最長の待機時間100[msec]より長く）
+#define	CONTROL_TIMEOUT		50		// ライントレース制御
+
+/*----------------------------------------------------------------------
+ * 電源電圧による補正（1: 電池の消耗によらず調整時のゲインを有効に保つ）
+ * 電源電圧の分圧回路を AD6 (PIO1_10) に配線した場合（ADC_VBAT_ON = 1）に有効となる
+ *----------------------------------------------------------------------*/
+#define	SUPPLY_COMP			ADC_VBAT_ON
+
 /*----------------------------------------------------------------------
  * 赤外線センサ値の正規化
  *----------------------------------------------------------------------*/
@@ -80,73 +96,102 @@ static short adjustCenter(void)
  * 1. 車体をトレースライン中央に設置し、原点までのオフセットを観測する
  * 2. ラインを跨ぐように車体を回転させ、左右差の最大、最小を観測する
  * 3. 左右それぞれのセンサ出力を正規化するための補正係数を算出する
+ *
+ * - 待機せずに状態を進める再開可能な関数（pt.h）とし、タスクの周期ごとに呼び出す
+ * - 計測が終われば PT_DONE を返し、次の呼び出しでは最初から計測する
  *----------------------------------------------------------------------*/
-static short calibrateIR(CalibrateIR_t *cal) {
-	int i, j;
+typedef struct {
+	Pt_t pt;						// 再開する位置
+	int i, j;						// 回転方向、サンプル番号
 	short offset, pwm;				// 原点オフセット平均値、モーター出力値
-	unsigned short L, minL, maxL;	// 左のセンサ値、最小値、最大値
-	unsigned short R, minR, maxR;	// 右のセンサ値、最小値、最大値
+	unsigned short minL, maxL;		// 左のセンサ値の最小値、最大値
+	unsigned short minR, maxR;		// 右のセンサ値の最小値、最大値
+} Calibrate_t;
+
+static Calibrate_t calib;
 
 #if TRACE_DEBUG
-	int n = 0;
-	IRData_t IR[N_SAMPLES * 2];
+static int calibN = 0;
+static IRData_t calibIR[N_SAMPLES * 2];
 #endif
 
+static int calibrateStep(CalibrateIR_t *cal) {
+	Calibrate_t *c = &calib;
+	unsigned short L, R;			// 左右のセンサ値
+
+	PT_BEGIN(&c->pt);
+
 	// 原点オフセット平均値を観測する
-	offset = adjustCenter();
+	c->offset = adjustCenter();
 
-	minL = minR = 0xFFF;
-	maxL = maxR = 0;
+	c->minL = c->minR = 0xFFF;
+	c->maxL = c->maxR = 0;
+
+#if TRACE_DEBUG
+	calibN = 0;
+#endif
 
 	// i = 0: 中央 → 左回転 → 右回転 → 中央
 	// i = 1; 中央 → 右回転 → 左回転 → 中央
-	for (pwm = MTR_POWER, i = 0; i < 2; i++, pwm = -pwm) {
-		for (j = 0; j < N_SAMPLES; j++) {
-			timerWait(10);
+	for (c->pwm = MTR_POWER, c->i = 0; c->i < 2; c->i++, c->pwm = -c->pwm) {
+		for (c->j = 0; c->j < N_SAMPLES; c->j++) {
+			PT_DELAY(&c->pt, 10);
 
-			if (j < N_SAMPLES / 2) {
-				pwmOut(+pwm, -pwm); // p > 0: 左回転, p < 0: 右回転
+			if (c->j < N_SAMPLES / 2) {
+				pwmRequest(PWM_SRC_CALIB, +c->pwm, -c->pwm, CALIB_TIMEOUT); // p > 0: 左回転, p < 0: 右回転
 			} else {
-				pwmOut(-pwm, +pwm); // p > 0: 右回転, p < 0: 左回転
+				pwmRequest(PWM_SRC_CALIB, -c->pwm, +c->pwm, CALIB_TIMEOUT); // p > 0: 右回転, p < 0: 左回転
 			}
 
 			// 左右センサの値を読み込む
 			adcRead2(&L, &R);
 
-			// センサ位置のオフセットを補正する
-			//L -= offset;
-			//R += offset;
-
 			// それぞれの最小値、最大値を観測する
-			minL = MIN(minL, L);
-			maxL = MAX(maxL, L);
-			minR = MIN(minR, R);
-			maxR = MAX(maxR, R);
+			c->minL = MIN(c->minL, L);
+			c->maxL = MAX(c->maxL, L);
+			c->minR = MIN(c->minR, R);
+			c->maxR = MAX(c->maxR, R);
 
 #if TRACE_DEBUG
-			IR[n  ].L = L;
-			IR[n++].R = R;
+			calibIR[calibN  ].L = L;
+			calibIR[calibN++].R = R;
 #endif
 
-			if (j == N_SAMPLES / 2 - 1) {
+			if (c->j == N_SAMPLES / 2 - 1) {
 				// 慣性モーメントがゼロになる様、完全に停止させる
-				pwmOut(0, 0);
-				timerWait(100);
+				pwmRequest(PWM_SRC_CALIB, 0, 0, CALIB_TIMEOUT);
+				PT_DELAY(&c->pt, 100);
 			}
 		}
 
 		// 慣性モーメントがゼロになる様、完全に停止させる
-		pwmOut(0, 0);
-		timerWait(100);
+		pwmRequest(PWM_SRC_CALIB, 0, 0, CALIB_TIMEOUT);
+		PT_DELAY(&c->pt, 100);
 	}
 
+	// 以降の制御に出力を譲る
+	pwmRelease(PWM_SRC_CALIB);
+
 	// キャリブレーションパラメータを設定する
 	cal->center  = IR_CENTER;
-	cal->offset  = offset;
-	cal->offsetL = minL;
-	cal->offsetR = minR;
-	cal->gainL   = IR_RANGE * 100 / (maxL - minL);
-	cal->gainR   = IR_RANGE * 100 / (maxR - minR);
+	cal->offset  = c->offset;
+	cal->offsetL = c->minL;
+	cal->offsetR = c->minR;
+	cal->gainL   = IR_RANGE * 100 / (c->maxL - c->minL);
+	cal->gainR   = IR_RANGE * 100 / (c->maxR - c->minR);
+
+	PT_END(&c->pt);
+}
+
+/*----------------------------------------------------------------------
+ * 赤外線センサの特性計測（計測が終わるまで待機する）
+ *----------------------------------------------------------------------*/
+static short calibrateIR(CalibrateIR_t *cal) {
+	PT_INIT(&calib.pt);
+
+	while (calibrateStep(cal) == PT_WAITING) {
+		timerWait(TASK_TICK);
+	}
 
 #if TRACE_DEBUG
 	// USBケーブルを接続し、通信の成立を確認する
@@ -154,30 +199,33 @@ static short calibrateIR(CalibrateIR_t *cal) {
 	sciInit();
 
 	while (1) {
+		int i;
+		unsigned short L, R;
+
 		// リターンキーを受信したら出力開始
 		sciWaitKey('\r');
 
 		// 補正係数用パラメータを出力する
 		sciPrintf("#cal,offset,minL,maxL,gainL,minR,maxR,gainR\r\n");
-		sciPrintf("0,%d,%d,%d,%d,%d,%d,%d\r\n", offset, minL, maxL, cal->gainL, minR, maxR, cal->gainR);
+		sciPrintf("0,%d,%d,%d,%d,%d,%d,%d\r\n", cal->offset, calib.minL, calib.maxL, cal->gainL, calib.minR, calib.maxR, cal->gainR);
 		sciPrintf("#No,L,R,L - R,L',R',L' - R'\r\n");
 
 		// キャリブレーション前後の値を出力する
-		for (i = 0; i < n; i++) {
+		for (i = 0; i < calibN; i++) {
 			// 原点オフセット平均値のみ、左右の正規化なし
-			L = IR[i].L - offset;
-			R = IR[i].R + offset;
+			L = calibIR[i].L - cal->offset;
+			R = calibIR[i].R + cal->offset;
 			sciPrintf("%d,%d,%d,%d,", i + 1, L, R, (short)(L - R));
 
 			// 左右の正規化あり
-			L = (IR[i].L - cal->offsetL) * cal->gainL / 100;
-			R = (IR[i].R - cal->offsetR) * cal->gainR / 100;
+			L = (calibIR[i].L - cal->offsetL) * cal->gainL / 100;
+			R = (calibIR[i].R - cal->offsetR) * cal->gainR / 100;
 			sciPrintf("%d,%d,%d\r\n", L, R, (short)(L - R));
 		}
 	}
 #endif
 
-	return offset;
+	return cal->offset;
 }
 
 /*----------------------------------------------------------------------
@@ -189,6 +237,33 @@ static void traceRun0(void) {
 	(void)calibrateIR(&cal);
 }
 
+/*----------------------------------------------------------------------
+ * ライントレースのタスク構成
+ * - 制御タスク:     CONTROL_PERIOD 周期、最優先（センサ読み込み～モーター指示）
+ * - スイッチタスク: SW_PERIOD 周期、スイッチ操作に応じて走行の停止／再開と読み出しを行う
+ * - 計測タスク:     LOG_PERIOD 周期、制御タスクの実行統計を送信する（TRACE_DEBUG）
+ * - 較正タスク:     CONTROL_PERIOD 周期、センサを較正してから制御タスクを開始する
+ *----------------------------------------------------------------------*/
+#define	CONTROL_PERIOD		1		// 制御周期[msec]
+#define	SW_PERIOD			10		// スイッチの監視周期[msec]
+#define	LOG_PERIOD			1000	// 実行統計の送信周期[msec]
+
+#define	PRIO_CONTROL		0		// 制御タスクの優先度（最優先）
+#define	PRIO_SW				1		// スイッチタスクの優先度
+#define	PRIO_LOG			2		// 計測タスクの優先度
+
+static CalibrateIR_t traceCal;					// キャリブレーションパラメータ
+static int traceControl = -1;					// 制御タスクの識別子
+static int traceCalib = -1;					// 較正タスクの識別子
+static volatile unsigned char traceReady = FALSE;	// 較正が終わり、走行可能
+
+/*----------------------------------------------------------------------
+ * LEDによる動作状態の表示
+ * - 走行中はトレースラインに対する車体の位置を ledShow() で表示する
+ *----------------------------------------------------------------------*/
+LED_PATTERN(traceLedCalib, 0, {LED1, 100}, {LED2, 100});		// 較正中：交互に点滅
+LED_PATTERN(traceLedStop,  0, {LED_ON, 500}, {LED_OFF, 500});	// 停止中：ゆっくり点滅
+
 /*----------------------------------------------------------------------
  * ライントレース - ON-OFF制御
  *----------------------------------------------------------------------*/
@@ -200,40 +275,34 @@ static const PID_t G1 = {
 	30000			// 旋回成分の制御量
 };
 
-static void traceRun1(void) {
+static void traceStep1(void) {
 	int L, R, E;	// 左右センサ値、偏差
 
-	// 赤外線センサのキャリブレーション
-	CalibrateIR_t cal;
-	(void)calibrateIR(&cal);
-
-	while (1) {
-		L = adcRead(ADC_LEFT );	// 左赤外線センサ値を読み込む
-		R = adcRead(ADC_RIGHT);	// 右赤外線センサ値を読み込む
+	L = adcRead(ADC_LEFT );	// 左赤外線センサ値を読み込む
+	R = adcRead(ADC_RIGHT);	// 右赤外線センサ値を読み込む
 
-		L = normalizeL(L, cal);		// 左赤外線センサ値を正規化する
-		R = normalizeR(R, cal);		// 右赤外線センサ値を正規化する
+	L = normalizeL(L, traceCal);	// 左赤外線センサ値を正規化する
+	R = normalizeR(R, traceCal);	// 右赤外線センサ値を正規化する
 
-		// 中心からのずれを算出する
-		E = L - R;
+	// 中心からのずれを算出する
+	E = L - R;
 
-		// 右寄りのズレが大きければ左に曲げる
-		if (E > 0 && L > IR_CENTER) {
-			pwmOut(-G1.TURNING/2, G1.TURNING);
-			ledOn(LED1);
-		}
+	// 右寄りのズレが大きければ左に曲げる
+	if (E > 0 && L > IR_CENTER) {
+		pwmRequest(PWM_SRC_CONTROL, -G1.TURNING/2, G1.TURNING, CONTROL_TIMEOUT);
+		ledShow(LED1);
+	}
 
-		// 左寄りのズレが大きければ右に曲げる
-		else if (E < 0 && R > IR_CENTER) {
-			pwmOut(G1.TURNING, -G1.TURNING/2);
-			ledOn(LED1);
-		}
+	// 左寄りのズレが大きければ右に曲げる
+	else if (E < 0 && R > IR_CENTER) {
+		pwmRequest(PWM_SRC_CONTROL, G1.TURNING, -G1.TURNING/2, CONTROL_TIMEOUT);
+		ledShow(LED1);
+	}
 
-		// 中央付近なら直進する
-		else {
-			pwmOut(G1.FORWARD, G1.FORWARD);
-			ledOn(LED2);
-		}
+	// 中央付近なら直進する
+	else {
+		pwmRequest(PWM_SRC_CONTROL, G1.FORWARD, G1.FORWARD, CONTROL_TIMEOUT);
+		ledShow(LED2);
 	}
 }
 
@@ -248,51 +317,45 @@ static const PID_t G2 = {
 	30000			// TURNING 旋回成分の制御量
 };
 
-static void traceRun2(void) {
+static void traceStep2(void) {
 	int L, R, E;	// 左右センサ値、偏差
 	int P;			// 旋回の比例成分
 
-	// 赤外線センサのキャリブレーション
-	CalibrateIR_t cal;
-	(void)calibrateIR(&cal);
-
-	while (1) {
-		L = adcRead(ADC_LEFT );	// 左赤外線センサ値を読み込む
-		R = adcRead(ADC_RIGHT);	// 右赤外線センサ値を読み込む
+	L = adcRead(ADC_LEFT );	// 左赤外線センサ値を読み込む
+	R = adcRead(ADC_RIGHT);	// 右赤外線センサ値を読み込む
 
-		L = normalizeL(L, cal);		// 左赤外線センサ値を正規化する
-		R = normalizeR(R, cal);		// 右赤外線センサ値を正規化する
+	L = normalizeL(L, traceCal);	// 左赤外線センサ値を正規化する
+	R = normalizeR(R, traceCal);	// 右赤外線センサ値を正規化する
 
-		// トレースライン中心からの偏差を算出する
-		E = L - R;
+	// トレースライン中心からの偏差を算出する
+	E = L - R;
 
-		// 旋回の比例成分を算出する
-		P = G2.KP * E;
+	// 旋回の比例成分を算出する
+	P = G2.KP * E;
 
-		// 右寄りのズレが大きければ左に曲げる
-		if (E > 0 && L > IR_CENTER) {
-			pwmOut(G2.TURNING - ABS(P), G2.FORWARD);
-			ledOn(LED1);
-		}
+	// 右寄りのズレが大きければ左に曲げる
+	if (E > 0 && L > IR_CENTER) {
+		pwmRequest(PWM_SRC_CONTROL, G2.TURNING - ABS(P), G2.FORWARD, CONTROL_TIMEOUT);
+		ledShow(LED1);
+	}
 
-		// 左寄りのズレが大きければ右に曲げる
-		else if (E < 0 && R > IR_CENTER) {
-			pwmOut(G2.FORWARD, G2.TURNING - ABS(P));
-			ledOn(LED1);
-		}
+	// 左寄りのズレが大きければ右に曲げる
+	else if (E < 0 && R > IR_CENTER) {
+		pwmRequest(PWM_SRC_CONTROL, G2.FORWARD, G2.TURNING - ABS(P), CONTROL_TIMEOUT);
+		ledShow(LED1);
+	}
 
-		// 中央付近なら直進する
-		else {
-			pwmOut(G2.FORWARD, G2.FORWARD);
-			ledOn(LED2);
-		}
+	// 中央付近なら直進する
+	else {
+		pwmRequest(PWM_SRC_CONTROL, G2.FORWARD, G2.FORWARD, CONTROL_TIMEOUT);
+		ledShow(LED2);
 	}
 }
 
 /*----------------------------------------------------------------------
  * ライントレース - PD制御
  *----------------------------------------------------------------------*/
-#define	DT	1000	// 微分用の制御周期[sec]の逆数[Hz]
+#define	DT	(1000 / CONTROL_PERIOD)	// 微分用の制御周期[sec]の逆数[Hz]
 #if	0	// 1. P項のみで当たりをつける
 #define	ADJUST_FORWARD	0
 static const PID_t G3 = {
@@ -322,64 +385,221 @@ static const PID_t G3 = {
 };
 #endif
 
-static void traceRun3(void) {
+/*----------------------------------------------------------------------
+ * カーブ手前のブレーキ（1: 旋回成分が閾値を超えた時点でブレーキをかける）
+ * 減速を短時間で済ませることで、直線の前進成分を上げることができる
+ *----------------------------------------------------------------------*/
+#define	CORNER_BRAKE		0
+#define	CORNER_THRESHOLD	30000	// カーブ進入と判定する旋回成分の制御量
+static const PwmBrakeProfile_t cornerBrake = {
+	PWM_MAX / 2,	// 逆転パルスのデューティ
+	10,				// 逆転パルスの時間[msec]
+	10,				// 短絡ブレーキの時間[msec]
+};
+
+static int traceQ = 0;		// 前回偏差
+#if	CORNER_BRAKE
+static int traceCurve = FALSE;	// カーブ走行中
+#endif
+
+static void traceStep3(void) {
 	int L, R;		// 左右の赤外線センサ値
 	int F, T;		// 前進成分、旋回成分の制御量
-	int P, Q = 0;	// P項の元となる偏差、前回偏差
+	int P;			// P項の元となる偏差
 	int D;			// D項の元となる偏差の微分値
 
-	// 赤外線センサのキャリブレーション
-	CalibrateIR_t cal;
-	(void)calibrateIR(&cal);
+	L = adcRead(ADC_LEFT );	// 左赤外線センサ値を読み込む
+	R = adcRead(ADC_RIGHT);	// 右赤外線センサ値を読み込む
 
-	while (1) {
-		L = adcRead(ADC_LEFT );	// 左赤外線センサ値を読み込む
-		R = adcRead(ADC_RIGHT);	// 右赤外線センサ値を読み込む
-
-		L = normalizeL(L, cal);		// 左赤外線センサ値を正規化する
-		R = normalizeR(R, cal);		// 右赤外線センサ値を正規化する
-
-		/*-----------------------------------------
-		 * 旋回成分の算出 - PD制御量
-		 *-----------------------------------------*/
-		P = L - R; 					// トレースライン中心からの偏差を算出する
-		D = (P - Q) * DT;			// 偏差の微分値を算出する
-		Q = P;						// 前回偏差を今回値で更新する
-		T = G3.KP * P + G3.KD * D;	// PD制御量を算出する
-
-		/*-----------------------------------------
-		 * 前進成分の算出 - カーブで減速させる
-		 *-----------------------------------------*/
+	L = normalizeL(L, traceCal);	// 左赤外線センサ値を正規化する
+	R = normalizeR(R, traceCal);	// 右赤外線センサ値を正規化する
+
+	/*-----------------------------------------
+	 * 旋回成分の算出 - PD制御量
+	 *-----------------------------------------*/
+	P = L - R; 					// トレースライン中心からの偏差を算出する
+	D = (P - traceQ) * DT;		// 偏差の微分値を算出する
+	traceQ = P;					// 前回偏差を今回値で更新する
+	T = G3.KP * P + G3.KD * D;	// PD制御量を算出する
+
+	/*-----------------------------------------
+	 * 前進成分の算出 - カーブで減速させる
+	 *-----------------------------------------*/
 #if	ADJUST_FORWARD
-		F = G3.FORWARD - ABS(T);
+	F = G3.FORWARD - ABS(T);
 #else
-		F = G3.FORWARD; // 減速なし
+	F = G3.FORWARD; // 減速なし
+#endif
+
+	/*-----------------------------------------
+	 * 前進成分と旋回成分を足し合わせて走行
+	 *-----------------------------------------*/
+	pwmRequest(PWM_SRC_CONTROL, F - T, F + T, CONTROL_TIMEOUT);
+
+#if	CORNER_BRAKE
+	/*-----------------------------------------
+	 * カーブ進入時にブレーキをかける
+	 *-----------------------------------------*/
+	if (!traceCurve && ABS(T) > CORNER_THRESHOLD) {
+		pwmBrake(&cornerBrake);
+	}
+	traceCurve = (ABS(T) > CORNER_THRESHOLD);
 #endif
 
-		/*-----------------------------------------
-		 * 前進成分と旋回成分を足し合わせて走行
-		 *-----------------------------------------*/
-		pwmOut(F - T, F + T);
+	ledShow(P > 0 ? LED2 : LED1);
+}
+
+/*----------------------------------------------------------------------
+ * スイッチタスク - スイッチ操作のイベントを処理する
+ * - クリック: 走行を停止／再開する
+ * - 長押し:   制御タスクの周期超過回数（overruns）を showValue() で読み出す
+ *             読み出し中のスイッチ操作は showEvent() に渡す
+ * - 制御タスクを妨げないよう、swGetEvent() で待機せず周期的に監視する
+ *----------------------------------------------------------------------*/
+static void swTask(void) {
+	static unsigned char stop = FALSE;
+	SwEvent_t e;
+	TaskStat_t s;
+
+	while (swGetEvent(&e)) {
+		// 較正中は走行を開始しない（選択時のイベントも捨てる）
+		if (!traceReady) {
+			continue;
+		}
+
+		if (showActive()) {
+			showEvent(&e);
+			continue;
+		}
+
+		switch (e.type) {
+		  case SW_EVT_CLICK:
+		  case SW_EVT_DOUBLE:
+			stop = !stop;
+			if (stop) {
+				taskSuspend(traceControl);
+				pwmRelease(PWM_SRC_CONTROL);
+				ledPlay(&traceLedStop, LED_PRIO_STATUS);
+			} else {
+				ledCancel(LED_PRIO_STATUS);
+				taskResume(traceControl);
+			}
+			break;
+
+		  case SW_EVT_LONG:
+			if (e.n == 1) {
+				taskStat(traceControl, &s);
+				showValue(s.overruns);
+			}
+			break;
 
-		ledOn(P > 0 ? LED2 : LED1);
+		  default:
+			break;
+		}
 	}
 }
 
+/*----------------------------------------------------------------------
+ * 較正タスク - 赤外線センサを較正し、終われば制御タスクを開始する
+ * - 較正中は LED1 と LED2 を交互に点滅させる（traceStart() で開始）
+ *----------------------------------------------------------------------*/
+static void calibTask(void) {
+	if (calibrateStep(&traceCal) == PT_WAITING) {
+		return;
+	}
+
+	ledCancel(LED_PRIO_STATUS);
+	traceReady = TRUE;
+	taskSuspend(traceCalib);
+	taskResume(traceControl);
+}
+
+#if	TRACE_DEBUG
+/*----------------------------------------------------------------------
+ * 計測タスク - 制御タスクの実行統計を送信する
+ *----------------------------------------------------------------------*/
+static void logTask(void) {
+	TaskStat_t s;
+
+	taskStat(traceControl, &s);
+	sciPrintf("control: runs=%ld max=%ld[cycles] late=%ld[usec] overruns=%ld\r\n",
+		s.runs, s.maxCycles, s.maxLate, s.overruns);
+#if	PLAY_STAT
+	sciPrintf("play: load=%ld/1000\r\n", playLoad());
+#endif
+}
+#endif
+
+/*----------------------------------------------------------------------
+ * ライントレースのタスクを登録して実行する（戻らない）
+ *----------------------------------------------------------------------*/
+static void traceStart(void (*step)(void)) {
+	// 赤外線センサのキャリブレーションが終わるまで、制御タスクは停止しておく
+	PT_INIT(&calib.pt);
+	traceCalib   = taskCreate(calibTask, CONTROL_PERIOD, PRIO_CONTROL);
+	traceControl = taskCreate(step, CONTROL_PERIOD, PRIO_CONTROL);
+	taskSuspend(traceControl);
+	ledPlay(&traceLedCalib, LED_PRIO_STATUS);
+
+	taskCreate(swTask, SW_PERIOD, PRIO_SW);
+#if	TRACE_DEBUG
+	taskCreate(logTask, LOG_PERIOD, PRIO_LOG);
+#endif
+
+	taskRun();
+}
+
+static void traceRun1(void) {
+	traceStart(traceStep1);
+}
+
+static void traceRun2(void) {
+	traceStart(traceStep2);
+}
+
+static void traceRun3(void) {
+	traceStart(traceStep3);
+}
+
 /*----------------------------------------------------------------------
  * ライントレース - PD制御 + 楽譜再生
  *----------------------------------------------------------------------*/
 static void traceRun4(void) {
-	const MusicScore_t ms[] = {
-#include "truth.dat"	// tempo = 155
-	};
-
-	// バックグラウンドで演奏
-	playScore(ms, sizeof(ms) / sizeof(MusicScore_t), 155, -1);
+	// バックグラウンドで演奏（登録した楽譜をフラッシュから直接読み出す）
+	scorePlay(SCORE_TRUTH, 0, -1);
 
 	// ライントレース - PD制御
 	traceRun3();
 }
 
+/*----------------------------------------------------------------------
+ * 走行モードの選択（スイッチ操作のイベントを受け取る）
+ * - 長押し1秒ごとに短音を鳴らし、走行モードを 1 ～ 4 に進める
+ * - 離した（クリック、ダブルクリック、長押しの解放）ら選択を確定する
+ * - 演奏中は短音で楽譜を上書きしないよう鳴らさない
+ *----------------------------------------------------------------------*/
+static volatile int selectMode;
+static volatile int selectDone;
+
+static void traceSelect(const SwEvent_t *e) {
+	static const MusicScore_t ms = {Ra6, N16};
+
+	switch (e->type) {
+	  case SW_EVT_LONG:
+		if (e->n <= 4) {
+			selectMode = e->n;
+			if (!playIsPlaying()) {
+				playScore(&ms, 1, 180, 0);
+			}
+		}
+		break;
+
+	  default:
+		selectDone = TRUE;
+		break;
+	}
+}
+
 /*----------------------------------------------------------------------
  * ライントレース
  * - runMode
@@ -390,29 +610,36 @@ static void traceRun4(void) {
  *	4: PD制御によるライントレース＋バックグラウンド演奏
  *----------------------------------------------------------------------*/
 void traceRun(int runMode) {
-	unsigned long t0, t1;
-	const MusicScore_t ms = {Ra6, N16};
-
 	timerInit();	// timerWait()
 	gpioInit();		// swStandby()
 	adcInit();		// A/D変換の初期化
 	pwmInit();		// PWM出力の初期化
 	playInit();		// playScore()
 
-	ledOn(LED_ON);	// LEDを点灯
+#if	SUPPLY_COMP
+	pwmSupplyComp(TRUE);	// 電源電圧による補正
+#endif
 
-	// スイッチが押されるまで待機
-	while (swScan() == SW_OFF);
+	// タイマー資源が競合していれば LED2 だけを点灯して知らせる
+	ledOn(timerConflicts() ? LED2 : LED_ON);
 
 	// スイッチが押された秒数に応じた走行モードを設定する
-	t0 = timerRead();
-	while (swScan() == SW_ON) {
-		t1 = timerRead();
-		if (t1 - t0 == 1000) {playScore(&ms, 1, 180, 0); runMode = 1;} else
-		if (t1 - t0 == 2000) {playScore(&ms, 1, 180, 0); runMode = 2;} else
-		if (t1 - t0 == 3000) {playScore(&ms, 1, 180, 0); runMode = 3;} else
-		if (t1 - t0 == 4000) {playScore(&ms, 1, 180, 0); runMode = 4;}
+	// 選択はイベントで行い、確定するまで割込みを待って眠る
+	selectMode = runMode;
+	selectDone = FALSE;
+	swSubscribe(traceSelect);
+	// 判定から WFI までの間に traceSelect() が実行されても眠り続けないよう、
+	// 割込み禁止で判定し直してから WFI を実行する
+	// Note: PRIMASK がセットされていても、割込みの発生で WFI から復帰する
+	while (!selectDone) {
+		__disable_irq();
+		if (!selectDone) {
+			__WFI();
+		}
+		__enable_irq();
 	}
+	swSubscribe(0);
+	runMode = selectMode;
 
 	// 少し待ってからスタート
 	timerWait(500);
@@ -14,6 +14,7 @@
 #include "type.h"
 #include "clk.h"
 #include "pmu.h"
+#include "os.h"
 #include "wdt.h"
 
 /*----------------------------------------------------------------------
@@ -105,16 +106,10 @@ void wdtFeed(void) {
  * WatchDog Timer - ウォッチドッグの更新
  *----------------------------------------------------------------------*/
 void wdtFeedSysTick(unsigned long msec) {
-	unsigned long mainclock;
+	sciPrintf("Main clock frequency = %d\r\n", clkGetMainClock());
 
-	// CPU main clock
-	mainclock = clkGetMainClock();
-
-	sciPrintf("Main clock frequency = %d\r\n", mainclock);
-
-	// SysTick_Config() is defined in  CMSIS_CORE_LPC13xx/inc/core_cm3.h
-	mainclock *= msec / 1000;
-	SysTick_Config(MAX(2, MIN(mainclock, 0x00FFFFFFUL)));
+	// SysTick はカーネルが管理し、その周期的なサービスとして登録する
+	osTickHook(wdtFeed, msec);
 }
 
 /*----------------------------------------------------------------------
@@ -132,14 +127,8 @@ void wdtStop(void) {
 	LPC_WDT->MOD = 0;		// Bit 0 (WDEN) Watchdog enable bit = disable
 	LPC_WDT->TC  = 0xFF;	// Bit 23:0 (COUNT) Watchdog time-out interval
 
-	// Stop SysTick interrupt
-	// 17.6.1 System Timer Control and status register (CTRL)
-	// Bit 0 (ENABLE): 0 = the counter is disabled
-	// Bit 1 (TICKINT): 0 = the System Tick interrupt is disabled
-	// Bit 2 (CLKSOURCE): 1 = the system clock 0 (CPU) clock, 0 = system tick clock divider (SYSTICKDIV)
-	if (SysTick->CTRL & (1<<0)) {
-		SysTick->CTRL &= (1<<2);
-	}
+	// SysTick によるウォッチドッグの更新を解除
+	osTickHook(0, 0);
 }
 
 /*----------------------------------------------------------------------
@@ -166,16 +155,6 @@ void wdtStart(void) {
 	LPC_WDT->FEED = 0x55;
 }
 
-/*----------------------------------------------------------------------
- * SysTickタイマーによる周期的なウォッチドッグの更新
- *----------------------------------------------------------------------*/
-void SysTick_Handler(void)
-{
-	wdtFeed();
-
-	sciPrintf("SysTick_Handler()\r\n");
-}
-
 /*----------------------------------------------------------------------
  * ウォッチドッグタイムアウト時の割込みハンドラ
  *----------------------------------------------------------------------*/
@@ -207,14 +186,14 @@ void WDT_IRQHandler(void) {
  * - タイムアウト時の振る舞を確認する
  *
  *　【WDT_FEED_ON = 0, WDT_RESET_CPU = 0】
- *	・failHandler() で wdtStart() を実行した場合
- *	  2秒後に WDT_IRQn 割り込みが発生し続け、メイン処理が停止する
+ *	・failReport() で wdtStart() を実行した場合
+ *	  2秒ごとに WDT_IRQn 割り込みが発生し、そのたびにモーターが非常停止する
  *
- *	・failHandler() で wdtStop() を実行した場合
+ *	・failReport() で wdtStop() を実行した場合
  *	  2秒後に WDT_IRQn 割り込みが停止し、メイン処理は継続される
  *
- *	・failHandler() で NVIC_SystemReset() を実行した場合
- *	  2秒後に failHandler() 内でリセットをかける
+ *	・failReport() で NVIC_SystemReset() を実行した場合
+ *	  2秒後にメイン処理で failReport() を実行し、リセットをかける
  *
  *　【WDT_FEED_ON = 0, WDT_RESET_CPU = 1】
  *	・failHandler() は実行されず即座にリセットがかかる
@@ -223,15 +202,16 @@ void WDT_IRQHandler(void) {
 #include "timer.h"
 #include "gpio.h"
 #include "play.h"
+#include "pwm.h"
+#include "work.h"
 #include "wdt.h"
 
 /*----------------------------------------------------------------------
- * タイムアウト時の割込みハンドラ WDT_IRQHandler() から呼び出される処理
+ * タイムアウト後にメイン処理で実行する処理（failHandler() から遅延実行）
  *----------------------------------------------------------------------*/
-static void failHandler(void) {
-	sciPrintf("failHandler\r\n");
+static void failReport(void) {
+	sciPrintf("failReport\r\n");
 
-	ledOn(LED2);
 	timerWait(250);
 	ledToggle(LED2);
 
@@ -244,6 +224,21 @@ static void failHandler(void) {
 #endif
 }
 
+/*----------------------------------------------------------------------
+ * タイムアウト時の割込みハンドラ WDT_IRQHandler() から呼び出される処理
+ * - 割込み中は非常停止だけを行い、待機を伴う処理は workPost() で遅延実行する
+ * - メイン処理が停止している場合に備え、リセットには WDT_RESET_CPU = 1 を使う
+ *----------------------------------------------------------------------*/
+static void failHandler(void) {
+	sciPrintf("failHandler\r\n");
+
+	// 他の指示元によらず、モーターを非常停止する
+	pwmEmergencyStop();
+
+	ledOn(LED2);
+	workPost(failReport);
+}
+
 /*----------------------------------------------------------------------
  * 動作例1:　メイン処理の中でウォッチドッグを叩く
  *----------------------------------------------------------------------*/
@@ -256,6 +251,7 @@ static void wdtExample1(void) {
 		ledToggle(LED1);
 		timerWait(500);
 		wdtFeed();					// 定期的にウォッチドッグを叩く
+		workRun();					// 割込みから依頼された処理を実行する
 	}
 }
 
@@ -271,6 +267,7 @@ static void wdtExample2(void) {
 	while (1) {
 		ledToggle(LED1);
 		timerWait(500);
+		workRun();					// 割込みから依頼された処理を実行する
 	}
 }
 
@@ -281,7 +278,7 @@ static void wdtExample2(void) {
  *	2: SysTick割り込み中でウォッチドッグを叩く
  *----------------------------------------------------------------------*/
 void wdtExample(int exampleType) {
-	const MusicScore_t m[] = {{Fa6, N16}, {Fa5, N16}};
+	static const MusicScore_t m[] = {{Fa6, N16}, {Fa5, N16}};
 
 	timerInit();	// timerWait()
 	gpioInit();		// ledToggle()
@@ -0,0 +1,106 @@
+/*===============================================================================
+ * Name        : work.c
+ * Author      : $(author)
+ * Version     :
+ * CPU type    : ARM Cortex-M3 LPC1343
+ * Copyright   : $(copyright)
+ * Description : Lock-free deferred-work queue for interrupt handlers
+ *===============================================================================*/
+// Cortex Microcontroller Software Interface Standard
+#ifdef __USE_CMSIS
+#include "LPC13xx.h"
+#endif
+
+#include "type.h"
+#include "atomic.h"
+#include "work.h"
+
+/*----------------------------------------------------------------------
+ * 遅延実行キュー
+ * - 投入側（割込みハンドラ、多重割込みを含む）は LDREX/STREX で workHead を進めて枠を予約する
+ * - 実行側（スレッドレベル）だけが workTail を進める
+ * - 予約から書き込みまでの間に実行されないよう、書き込みを終えた枠に ready を立てる
+ *----------------------------------------------------------------------*/
+typedef struct {
+	void (* volatile func)(void);	// 実行する関数
+	volatile unsigned char ready;	// 1: 書き込み済み
+} Work_t;
+
+static Work_t workQueue[WORK_SLOTS];
+static volatile unsigned long workHead = 0;	// 次に予約する位置
+static volatile unsigned long workTail = 0;	// 次に実行する位置
+static Atomic_t workDrop = 0;				// 満杯で投入できなかった回数
+
+#define	WORK_MASK	(WORK_SLOTS - 1)
+
+/*----------------------------------------------------------------------
+ * 遅延実行する関数の投入（割込みハンドラから呼び出せる）
+ * - 戻り値は 0: 成功、-1: 満杯
+ *----------------------------------------------------------------------*/
+int workPost(void (*f)(void)) {
+	unsigned long head;
+	Work_t *w;
+
+	if (!f) {
+		return -1;
+	}
+
+	// ARMv7-M Architecture Reference Manual A3.4 Synchronization and semaphores
+	// 予約の途中で多重割込みが予約した場合は STREX が失敗し、やり直す
+	do {
+		head = __LDREXW((uint32_t *)&workHead);
+		if (head - workTail >= WORK_SLOTS) {
+			__CLREX();
+			atomicInc(&workDrop);
+			return -1;
+		}
+	} while (__STREXW(head + 1, (uint32_t *)&workHead));
+
+	w = &workQueue[head & WORK_MASK];
+	w->func  = f;
+	w->ready = 1;
+
+	return 0;
+}
+
+/*----------------------------------------------------------------------
+ * 投入された関数を投入順に実行する（スレッドレベルから呼び出す）
+ * - 実行中に投入された関数も実行するが、1回の呼び出しで WORK_SLOTS 個までとする
+ * - 戻り値は実行した数
+ *----------------------------------------------------------------------*/
+int workRun(void) {
+	int n;
+
+	for (n = 0; n < WORK_SLOTS && workTail != workHead; n++) {
+		Work_t *w = &workQueue[workTail & WORK_MASK];
+		void (*f)(void);
+
+		// 予約済みで書き込み中（割込みハンドラの途中）なら次回に回す
+		if (!w->ready) {
+			break;
+		}
+
+		// 関数を取り出してから枠を解放し、投入側が再利用できるようにする
+		f = w->func;
+		w->ready = 0;
+		workTail++;
+
+		f();
+	}
+
+	return n;
+}
+
+/*----------------------------------------------------------------------
+ * 未実行の数
+ *----------------------------------------------------------------------*/
+int workPending(void) {
+	return (int) (workHead - workTail);
+}
+
+/*----------------------------------------------------------------------
+ * 満杯で投入できなかった回数
+ *----------------------------------------------------------------------*/
+unsigned long workLost(void) {
+	return atomicLoad(&workDrop);
+}
@@ -0,0 +1,190 @@
+/*===============================================================================
+ * Name        : atomic_test.c
+ * Description : Host-side stress test of the atomic operations (inc/atomic.h)
+ *
+ * 使い方（ホスト上でビルドして実行する、戻り値 0: 成功）:
+ *	gcc -O2 -pthread -D__USE_CMSIS -I tools/host -I inc \
+ *		tools/atomic_test.c -o atomic_test && ./atomic_test
+ *===============================================================================*/
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+
+// Cortex Microcontroller Software Interface Standard（ホスト用の代替）
+#ifdef __USE_CMSIS
+#include "LPC13xx.h"
+#endif
+
+#include "type.h"
+#include "atomic.h"
+
+/*----------------------------------------------------------------------
+ * テストの設定
+ * - 複数のスレッドから同じ変数を同時に操作し、更新が失われないことを確認する
+ * - LDREX/STREX はホスト用の代替（tools/host/LPC13xx.h）で排他モニタを模擬する
+ *----------------------------------------------------------------------*/
+#define	TEST_THREADS	4			// 同時に操作するスレッド数
+#define	TEST_COUNT		500000UL	// スレッドごとの操作回数
+
+static Atomic_t counter;			// atomicInc / atomicDecIfPositive の対象
+static unsigned long decCount[TEST_THREADS];	// atomicDecIfPositive で減算できた回数
+
+static AtomicFlag_t lock;			// atomicFlagTestAndSet によるスピンロック
+static volatile unsigned long locked;	// ロック中だけ更新する（不可分でない加算）
+
+static AtomicFlag_t token;			// atomicFlagTestAndClear で受け渡すフラグ
+static unsigned long taken[TEST_THREADS];	// フラグを受け取った回数
+static volatile int tokenDone;		// 1: 送り側が終了した
+
+/*----------------------------------------------------------------------
+ * スレッドの起動と終了待ち
+ *----------------------------------------------------------------------*/
+static void runThreads(void *(*f)(void *)) {
+	pthread_t t[TEST_THREADS];
+	long i;
+
+	for (i = 0; i < TEST_THREADS; i++) {
+		pthread_create(&t[i], 0, f, (void *)i);
+	}
+	for (i = 0; i < TEST_THREADS; i++) {
+		pthread_join(t[i], 0);
+	}
+}
+
+/*----------------------------------------------------------------------
+ * atomicInc: 同時に加算しても合計が一致する
+ *----------------------------------------------------------------------*/
+static void *incThread(void *arg) {
+	unsigned long i;
+
+	for (i = 0; i < TEST_COUNT; i++) {
+		atomicInc(&counter);
+	}
+
+	return arg;
+}
+
+static long testInc(void) {
+	counter = 0;
+	runThreads(incThread);
+
+	printf("atomicInc: %lu (expected %lu)\n", counter, TEST_THREADS * TEST_COUNT);
+	return counter != TEST_THREADS * TEST_COUNT;
+}
+
+/*----------------------------------------------------------------------
+ * atomicDecIfPositive: 減算できた回数の合計が初期値と一致し、0 で止まる
+ *----------------------------------------------------------------------*/
+static void *decThread(void *arg) {
+	long n = (long)arg;
+
+	decCount[n] = 0;
+	while (atomicDecIfPositive(&counter)) {
+		decCount[n]++;
+	}
+
+	return arg;
+}
+
+static long testDecIfPositive(void) {
+	unsigned long sum = 0;
+	int i;
+
+	counter = TEST_THREADS * TEST_COUNT / 2;
+	runThreads(decThread);
+
+	for (i = 0; i < TEST_THREADS; i++) {
+		sum += decCount[i];
+	}
+
+	printf("atomicDecIfPositive: %lu (expected %lu), final %lu\n",
+		sum, TEST_THREADS * TEST_COUNT / 2, counter);
+	return sum != TEST_THREADS * TEST_COUNT / 2 || counter != 0;
+}
+
+/*----------------------------------------------------------------------
+ * atomicFlagTestAndSet / atomicFlagClear: スピンロックで排他できる
+ *----------------------------------------------------------------------*/
+static void *lockThread(void *arg) {
+	unsigned long i;
+
+	for (i = 0; i < TEST_COUNT / 4; i++) {
+		while (atomicFlagTestAndSet(&lock)) {
+			sched_yield();
+		}
+		locked = locked + 1;
+		atomicBarrier();
+		atomicFlagClear(&lock);
+	}
+
+	return arg;
+}
+
+static long testFlagLock(void) {
+	locked = 0;
+	atomicFlagClear(&lock);
+	runThreads(lockThread);
+
+	printf("atomicFlagTestAndSet: %lu (expected %lu)\n", locked, TEST_THREADS * (TEST_COUNT / 4));
+	return locked != TEST_THREADS * (TEST_COUNT / 4) || atomicFlagTest(&lock);
+}
+
+/*----------------------------------------------------------------------
+ * atomicFlagTestAndClear: セットしたフラグを受け取れるのは1スレッドだけ
+ * - スレッド 0 がセットし、他のスレッドが奪い合う
+ *----------------------------------------------------------------------*/
+static void *tokenThread(void *arg) {
+	long n = (long)arg;
+	unsigned long i;
+
+	taken[n] = 0;
+	if (n == 0) {
+		for (i = 0; i < TEST_COUNT / 4; i++) {
+			while (atomicFlagTest(&token)) {
+				sched_yield();
+			}
+			atomicFlagSet(&token);
+		}
+		tokenDone = 1;
+		return arg;
+	}
+
+	while (!tokenDone || atomicFlagTest(&token)) {
+		if (atomicFlagTestAndClear(&token)) {
+			taken[n]++;
+		} else {
+			sched_yield();
+		}
+	}
+
+	return arg;
+}
+
+static long testFlagHandoff(void) {
+	unsigned long sum = 0;
+	int i;
+
+	tokenDone = 0;
+	atomicFlagClear(&token);
+	runThreads(tokenThread);
+
+	for (i = 1; i < TEST_THREADS; i++) {
+		sum += taken[i];
+	}
+
+	printf("atomicFlagTestAndClear: %lu (expected %lu)\n", sum, TEST_COUNT / 4);
+	return sum != TEST_COUNT / 4;
+}
+
+int main(void) {
+	long errors = 0;
+
+	errors += testInc();
+	errors += testDecIfPositive();
+	errors += testFlagLock();
+	errors += testFlagHandoff();
+
+	printf("atomic: errors %ld\n", errors);
+
+	return errors ? 1 : 0;
+}
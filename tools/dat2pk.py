@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+#===============================================================================
+# Name        : dat2pk.py
+# Description : 楽譜データ（*.dat）を圧縮した楽譜データ（*_pk.dat）に変換する
+#
+# 使い方:
+#	python3 tools/dat2pk.py inc/truth.dat > inc/truth_pk.dat
+#
+# - MusicScore_t の {pitch, duration} を PackedScore_t の PS(pitch, duration) に置き換える
+# - 同じ音符の並びが続く箇所は PR(len, count) に置き換える（len, count = 1 ～ 16）
+# - #if 0 / #elif 1 などで選択された部分だけを変換する（条件は 0 か 1 のみ）
+#===============================================================================
+import re
+import sys
+
+# 音符長（play.h の定義と同じ）
+NOTES = {
+	'N16': 1, 'N8': 2, 'N8x': 3, 'N4': 4, 'N4x': 6, 'N2': 8, 'N2x': 12, 'N0': 16,
+	'N84': 6, 'N83': 8, 'N82': 10, 'N81': 14, 'N80': 18,
+}
+
+REPEAT_MAX = 16		# PR() で指定できる len, count の最大値
+PER_LINE   = 8		# 1行に出力する要素数
+
+
+def preprocess(text):
+	"""コメントを除き、#if 0|1 ～ #endif で有効な行だけを返す"""
+	text = re.sub(r'/\*.*?\*/', '', text, flags=re.S)
+	text = re.sub(r'//[^\n]*', '', text)
+
+	lines = []
+	stack = []	# (この分岐が有効か, 既に有効な分岐があったか)
+	for line in text.splitlines():
+		m = re.match(r'\s*#\s*(if|elif|else|endif)\b\s*(\S*)', line)
+		if m:
+			d, arg = m.group(1), m.group(2)
+			if d == 'if':
+				on = arg != '0'
+				stack.append((on, on))
+			elif d == 'elif':
+				on, done = stack.pop()
+				on = not done and arg != '0'
+				stack.append((on, done or on))
+			elif d == 'else':
+				on, done = stack.pop()
+				stack.append((not done, True))
+			else:
+				stack.pop()
+			continue
+		if all(on for on, _ in stack):
+			lines.append(line)
+	return '\n'.join(lines)
+
+
+def duration(expr):
+	"""音符長の式（N4x + N0 など）を評価する"""
+	n = eval(expr, {'__builtins__': {}}, NOTES)
+	if not 0 < n <= 0xFF:
+		raise ValueError('duration out of range: ' + expr)
+	return n
+
+
+def parse(text):
+	"""{pitch, duration} の並びを (pitch, 式, 値) のリストにする"""
+	notes = []
+	for m in re.finditer(r'\{\s*(\w+)\s*,\s*([^}]+?)\s*\}', preprocess(text)):
+		expr = re.sub(r'\s+', ' ', m.group(2))
+		notes.append((m.group(1), expr, duration(expr)))
+	return notes
+
+
+def key(notes):
+	"""比較には音階と音符長の値を使う（N8x と N8 + N16 は同じ音符）"""
+	return [(p, n) for p, _, n in notes]
+
+
+def pack(notes):
+	"""直前の区間を繰り返す箇所を PR() にまとめる（貪欲法）"""
+	out = []
+	lit = 0		# 直前に出力した PS() の連続数（PR() が参照できる範囲）
+	i = 0
+	while i < len(notes):
+		best = None
+		for n in range(1, min(REPEAT_MAX, lit) + 1):
+			k = 0
+			while k < REPEAT_MAX and key(notes[i + k * n:i + (k + 1) * n]) == key(notes[i - n:i]):
+				k += 1
+			# 置き換えで減る要素数: n × k - 1
+			if k and (best is None or n * k - 1 > best[0] * best[1] - 1):
+				best = (n, k)
+		if best and best[0] * best[1] > 1:
+			out.append('PR(%d, %d)' % best)
+			i += best[0] * best[1]
+			lit = 0
+		else:
+			p, expr, _ = notes[i]
+			out.append('PS(%s, %s)' % (p, expr))
+			i += 1
+			lit += 1
+	return out
+
+
+def main():
+	if len(sys.argv) != 2:
+		sys.exit('usage: dat2pk.py score.dat')
+
+	with open(sys.argv[1], encoding='utf-8') as f:
+		notes = parse(f.read())
+	out = pack(notes)
+
+	w = sys.stdout.write
+	w('/*----------------------------------------------------------------------\r\n')
+	w(' * %s から tools/dat2pk.py で生成（編集しないこと）\r\n' % sys.argv[1].split('/')[-1])
+	w(' * 音符数 %d、要素数 %d（%d バイト、MusicScore_t では %d バイト）\r\n'
+		% (len(notes), len(out), len(out) * 2, len(notes) * 4))
+	w(' *----------------------------------------------------------------------*/\r\n')
+	for i in range(0, len(out), PER_LINE):
+		w(', '.join(out[i:i + PER_LINE]) + ',\r\n')
+
+
+if __name__ == '__main__':
+	main()
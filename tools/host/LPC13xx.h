@@ -0,0 +1,79 @@
+/*===============================================================================
+ * Name        : LPC13xx.h
+ * Description : Host stub of CMSIS for host-side tests in tools/
+ *===============================================================================*/
+#ifndef __LPC13xx_H__
+#define __LPC13xx_H__
+
+#include <stdint.h>
+#include <sched.h>
+
+/*----------------------------------------------------------------------
+ * ホスト（PC）上でテストするための CMSIS の代替
+ * - 割込みは存在しないため、割込み禁止と NVIC の操作は何もしない
+ * - メモリバリアはコンパイラの組込み関数（完全なフェンス）で代替する
+ * - LDREX/STREX は排他モニタをスレッドごとの予約と比較交換で模擬する
+ *   （予約後に他のスレッドが書き込んでいれば STREX は失敗する）
+ * - Atomic_t はホストでは 64 ビットのため、ポインタは unsigned long に戻して扱う
+ *----------------------------------------------------------------------*/
+typedef int IRQn_Type;
+
+typedef struct {
+	volatile uint32_t ISER[8];
+} NVIC_Type;
+
+static NVIC_Type hostNVIC;
+#define	NVIC	(&hostNVIC)
+
+#define	atomicBarrier()			__sync_synchronize()
+#define	__DSB()					__sync_synchronize()
+#define	__ISB()					__sync_synchronize()
+#define	__DMB()					__sync_synchronize()
+
+#define	__get_PRIMASK()			0UL
+#define	__set_PRIMASK(x)		((void)(x))
+#define	__disable_irq()
+#define	__enable_irq()
+
+#define	NVIC_EnableIRQ(irq)		((void)(irq))
+#define	NVIC_DisableIRQ(irq)	((void)(irq))
+
+/*----------------------------------------------------------------------
+ * 排他モニタの模擬
+ * - LDREX で読んだアドレスと値を予約し、STREX は値が変わっていなければ書き込む
+ * - 単一CPUでも競合が起きるよう、LDREX の一定回数ごとに他のスレッドに譲る
+ *   （LDREX と STREX の間で切り替わり、STREX が失敗する経路を通す）
+ *----------------------------------------------------------------------*/
+#define	HOST_EX_YIELD	64		// 他のスレッドに譲る間隔（LDREX の回数）
+
+static __thread volatile unsigned long *hostExAddr;	// 予約したアドレス（0: 予約なし）
+static __thread unsigned long hostExValue;			// 予約時に読んだ値
+static __thread unsigned int hostExCount;			// LDREX の回数
+
+static inline unsigned long hostLdrex(volatile unsigned long *p) {
+	hostExValue = __atomic_load_n(p, __ATOMIC_SEQ_CST);
+	hostExAddr = p;
+
+	if (++hostExCount % HOST_EX_YIELD == 0) {
+		sched_yield();
+	}
+
+	return hostExValue;
+}
+
+static inline uint32_t hostStrex(unsigned long v, volatile unsigned long *p) {
+	unsigned long expected = hostExValue;
+
+	if (hostExAddr != p) {
+		return 1;		// 予約なし（CLREX 後、または別のアドレス）
+	}
+	hostExAddr = 0;
+
+	return !__atomic_compare_exchange_n(p, &expected, v, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+#define	__LDREXW(p)				hostLdrex((volatile unsigned long *)(p))
+#define	__STREXW(v, p)			hostStrex((v), (volatile unsigned long *)(p))
+#define	__CLREX()				(hostExAddr = 0)
+
+#endif // __LPC13xx_H__
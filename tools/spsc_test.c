@@ -0,0 +1,169 @@
+/*===============================================================================
+ * Name        : spsc_test.c
+ * Description : Host-side stress test of the SPSC ring buffer (src/atomic.c)
+ *
+ * 使い方（ホスト上でビルドして実行する、戻り値 0: 成功）:
+ *	gcc -O2 -pthread -D__USE_CMSIS -I tools/host -I inc \
+ *		tools/spsc_test.c src/atomic.c -o spsc_test && ./spsc_test
+ *===============================================================================*/
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+
+// Cortex Microcontroller Software Interface Standard（ホスト用の代替）
+#ifdef __USE_CMSIS
+#include "LPC13xx.h"
+#endif
+
+#include "type.h"
+#include "atomic.h"
+
+/*----------------------------------------------------------------------
+ * テストの設定
+ * - 書き込み側と読み出し側を別スレッドとし、割込みハンドラとメイン処理の
+ *   受け渡しを模擬する（スレッドは真に並行に動くため、割込みより厳しい）
+ * - 要素は複数ワードとし、書きかけの要素を読み出していないかも確認する
+ *----------------------------------------------------------------------*/
+#define	TEST_COUNT		2000000UL	// 受け渡す要素数
+#define	TEST_SIZE		8			// リングバッファの要素数（2のべき乗）
+
+typedef struct {
+	unsigned long seq;		// 通し番号
+	unsigned long check;	// 通し番号の反転（書きかけの検出用）
+	unsigned char pad[5];	// ワード境界にそろわない大きさにする
+} TestItem_t;
+
+SPSC_DEFINE(testQueue, TestItem_t, TEST_SIZE);
+
+static unsigned long fullCount;		// 満杯で書き込めなかった回数
+static unsigned long emptyCount;	// 空で読み出せなかった回数
+static volatile int testAbort;		// 1: 読み出し側が確認を打ち切った（書き込み側も止める）
+
+/*----------------------------------------------------------------------
+ * 書き込み側: 通し番号を順に書き込む（満杯なら再試行）
+ *----------------------------------------------------------------------*/
+static void *producer(void *arg) {
+	TestItem_t item;
+	unsigned long i;
+	int j;
+
+	for (i = 0; i < TEST_COUNT; i++) {
+		item.seq   = i;
+		item.check = ~i;
+		for (j = 0; j < (int)sizeof(item.pad); j++) {
+			item.pad[j] = (unsigned char)(i + j);
+		}
+
+		// 単一CPUでも進むよう、待つ間は相手のスレッドに譲る
+		while (spscPut(&testQueue, &item)) {
+			if (testAbort) {
+				return arg;
+			}
+			fullCount++;
+			sched_yield();
+		}
+	}
+
+	return arg;
+}
+
+/*----------------------------------------------------------------------
+ * 読み出し側: 通し番号の連続性と内容を確認する
+ *----------------------------------------------------------------------*/
+static void *consumer(void *arg) {
+	TestItem_t item;
+	unsigned long i;
+	int j, n;
+	long *errors = arg;
+
+	for (i = 0; i < TEST_COUNT; i++) {
+		while (spscGet(&testQueue, &item)) {
+			emptyCount++;
+			sched_yield();
+		}
+
+		// 格納数は 0 ～ TEST_SIZE の範囲
+		n = spscCount(&testQueue);
+		if (n < 0 || n > TEST_SIZE) {
+			printf("count out of range: %d\n", n);
+			(*errors)++;
+		}
+
+		if (item.seq != i || item.check != ~i) {
+			printf("sequence error: expected %lu, got %lu (check %lx)\n", i, item.seq, item.check);
+			(*errors)++;
+			i = item.seq;	// 以降は受け取った番号から確認を続ける
+		}
+
+		for (j = 0; j < (int)sizeof(item.pad); j++) {
+			if (item.pad[j] != (unsigned char)(item.seq + j)) {
+				printf("torn item: seq %lu\n", item.seq);
+				(*errors)++;
+				break;
+			}
+		}
+
+		if (*errors > 10) {
+			testAbort = 1;
+			break;
+		}
+	}
+
+	return 0;
+}
+
+/*----------------------------------------------------------------------
+ * 空と満杯の境界（別スレッドなし）
+ *----------------------------------------------------------------------*/
+static long testBoundary(void) {
+	TestItem_t item = {0};
+	long errors = 0;
+	int i;
+
+	if (spscGet(&testQueue, &item) != -1) {
+		printf("get from empty queue succeeded\n");
+		errors++;
+	}
+
+	for (i = 0; i < TEST_SIZE; i++) {
+		item.seq = i;
+		if (spscPut(&testQueue, &item)) {
+			printf("put %d failed before full\n", i);
+			errors++;
+		}
+	}
+
+	if (spscPut(&testQueue, &item) != -1 || spscCount(&testQueue) != TEST_SIZE) {
+		printf("put to full queue succeeded\n");
+		errors++;
+	}
+
+	for (i = 0; i < TEST_SIZE; i++) {
+		if (spscGet(&testQueue, &item) || item.seq != (unsigned long)i) {
+			printf("get %d failed\n", i);
+			errors++;
+		}
+	}
+
+	return errors;
+}
+
+int main(void) {
+	pthread_t p, c;
+	long errors;
+
+	errors = testBoundary();
+
+	// head/tail がワード長で折り返す場合も確認する
+	testQueue.head = testQueue.tail = (unsigned long)-3;
+
+	pthread_create(&c, 0, consumer, &errors);
+	pthread_create(&p, 0, producer, 0);
+	pthread_join(p, 0);
+	pthread_join(c, 0);
+
+	printf("spsc: %lu items, full %lu, empty %lu, errors %ld\n",
+		TEST_COUNT, fullCount, emptyCount, errors);
+
+	return errors ? 1 : 0;
+}